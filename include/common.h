@@ -4,8 +4,15 @@
 #define SCR_WIDTH 1280.0f
 #define SCR_HEIGHT 720.0f
 
+#ifndef MAZE_WIDTH
 #define MAZE_WIDTH 16
+#endif
+#ifndef MAZE_HEIGHT
 #define MAZE_HEIGHT 9
+#endif
+
+// number of cells per side of the square regions the maze mesh is split into for culling
+#define MAZE_CHUNK_SIZE 4
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -15,6 +22,28 @@
 #define WALL_THICKNESS 0.2f
 #define HALF_WALL_THICKNESS (WALL_THICKNESS / 2.0f)
 
+// upper limit of the lights that shade a single maze cell
+#define MAX_LIGHTS_PER_CELL 16
+// resolution of the baked lightmap, it covers the maze from above
+#define LIGHTMAP_TEXELS_PER_CELL 8
+
+// the simulation advances in ticks of a fixed length, whatever the frame rate
+#define TICK_RATE 120
+#define TICK_DURATION (1.0 / TICK_RATE)
+// a longer frame, e.g. after a breakpoint or a window drag, is cut short rather than simulated tick by tick
+#define MAX_FRAME_TIME 0.25
+// frames are never drawn faster than this while playing, 0 leaves it to the swap interval
+#define MAX_FRAME_RATE 240
+// when rendering on demand, how long the threads sleep while nothing happens before looking again
+#define IDLE_WAIT_TIMEOUT 0.5
+#define IDLE_REDRAW_INTERVAL 0.25
+// dynamic resolution shrinks the 3D view down to this fraction of the window size, per side,
+// to keep the frame within its budget in milliseconds
+#define FRAME_TIME_BUDGET 16.6f
+#define MIN_RENDER_SCALE 0.5f
+// players sharing the window in split screen, every one in its own part of it
+#define MAX_PLAYERS 4
+
 #define MINIMAP_WIDTH 0.5f
 #define MINIMAP_HEIGHT 0.5f
 #define MINIMAP_X    0.4f
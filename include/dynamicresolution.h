@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+// Renders the 3D view into an offscreen target and scales it up to the viewport. The fraction
+// of the viewport size it renders at follows the GPU time the view took in the last frames,
+// as timed by the profiler, so that the frame stays within FRAME_TIME_BUDGET.
+class DynamicResolution
+{
+public:
+    DynamicResolution();
+    virtual ~DynamicResolution();
+
+    // Feeds in the GPU time of the view, begin to end, of a past frame
+    void addTiming(float ms);
+    // Redirects the drawing into the offscreen target, at the current fraction of the viewport
+    void begin();
+    // Scales what was drawn up into the viewport of the framebuffer bound before begin
+    void end();
+
+    // Size of the 3D view in pixels
+    int width() const;
+    int height() const;
+
+private:
+    void allocate(int width, int height);
+
+    unsigned int m_framebuffer;
+    unsigned int m_renderbuffers[2];
+    int m_allocatedWidth;
+    int m_allocatedHeight;
+    int m_outputFramebuffer;
+    int m_viewport[4];
+
+    float m_scale;
+    float m_averageMs;
+    // scale changes are only made once the average has settled on the previous one
+    int m_framesSinceChange;
+};
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+#include <deque>
+
+// frames read back before the oldest one has to be done, which gives the GPU that many frames to finish it
+#define CAPTURE_RING_SIZE 3
+// frames waiting for the writer at most, past that the render thread waits for it to catch up
+#define CAPTURE_QUEUE_SIZE 8
+
+// Records the frames drawn into the bound read buffer as a numbered image sequence. Every frame is
+// read into a pixel buffer object of a ring and fenced, so the read back does not stall the pipeline,
+// and it is only mapped a few frames later once its fence has signalled. The pixels are then handed
+// to a writer thread that flips and encodes them, so the render thread only pays for a copy.
+class FrameCapture
+{
+public:
+    // The path is a printf pattern taking the frame number, e.g. "capture/frame_%05d.png", which has to
+    // pass isValidPattern. Frames are written as PNG if it ends in .png and as binary PPM otherwise.
+    FrameCapture(const std::string &pathPattern);
+    // Writes out the frames still in flight, the GL context has to be current
+    virtual ~FrameCapture();
+
+    // Reads back the frame drawn at the given size, right after drawing it and before swapping
+    void capture(int width, int height);
+    // Waits for the frames in flight and for the writer to write them, the GL context has to be current
+    void finish();
+
+    int capturedFrames() const;
+
+    // Whether the pattern has a single integer conversion for the frame number, with no other
+    // conversion than %% around it, so that it is safe to hand to printf
+    static bool isValidPattern(const std::string &pattern);
+    // Writes RGBA pixels as read by glReadPixels to a binary PPM, flipping the rows from the bottom up
+    // order GL reads them in to the top down one of the file
+    static void writePpm(FILE *file, const std::vector<unsigned char> &pixels, int width, int height);
+
+private:
+    struct Slot {
+        GLuint buffer;
+        GLsync fence;
+        int width, height;
+        int frame;
+    };
+
+    struct Image {
+        std::vector<unsigned char> pixels;
+        int width, height;
+        int frame;
+    };
+
+    // Maps the buffer of a slot whose fence signalled, or blocks until it does, and queues its pixels
+    void collect(Slot &slot);
+    void writerLoop();
+    void write(const Image &image);
+
+    std::string m_pathPattern;
+    bool m_png;
+    Slot m_slots[CAPTURE_RING_SIZE];
+    // the slot the next frame is read into, the oldest one in flight
+    int m_nextSlot;
+    int m_frame;
+
+    std::thread m_thread;
+    std::deque<Image> m_queue;
+    // buffers the writer is done with, so that the copies do not allocate once the capture is going
+    std::vector<std::vector<unsigned char> > m_spare;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+    // writer thread, so that a path that cannot be written is only reported once
+    bool m_writeFailed;
+};
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMELIMITER_H
+#define FRAMELIMITER_H
+
+#include <chrono>
+
+// Keeps the frames from coming faster than a given rate. Sleeping is only as precise as the
+// scheduler, so it sleeps through most of the wait and spins through the last stretch of it.
+class FrameLimiter
+{
+public:
+    // A rate of 0 does not limit anything
+    FrameLimiter(double framesPerSecond);
+
+    // Returns once the next frame is due
+    void wait();
+
+private:
+    std::chrono::steady_clock::duration m_frameDuration;
+    std::chrono::steady_clock::time_point m_nextFrame;
+};
+
+#endif
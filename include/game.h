@@ -25,10 +25,30 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include "player.h"
+#include "lightgrid.h"
+#include "triplebuffer.h"
+#include "trajectory.h"
+#include "common.h"
+
+#include <glm/glm.hpp>
+#include <atomic>
+#include <bitset>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
 class MazeCell;
 class Minimap;
 class Maze;
+class Hud;
+class DynamicResolution;
+class SoftwareRenderer;
+class GhostRenderer;
 
+// The simulation runs on the thread that feeds it input and calls update, the rendering on the
+// thread that calls draw. They share nothing but the snapshots the simulation publishes.
 class Game
 {
 public:
@@ -43,7 +63,22 @@ public:
         KEY_RIGHT_2,
         KEY_MOVE_UP,
         KEY_MOVE_DOWN,
-        KEY_RESET
+        KEY_RESET,
+        KEY_TOGGLE_HUD,
+        KEY_TOGGLE_ON_DEMAND,
+        KEY_MINIMAP_ZOOM_IN,
+        KEY_MINIMAP_ZOOM_OUT,
+        KEY_NEXT_VIEW_RENDERER,
+        KEY_RESTART_RUN,
+        KEY_COUNT
+    };
+
+    // The ways of drawing the 3D view, the mesh on the GPU, rays marched on the GPU and rays cast on the CPU
+    enum ViewRenderer {
+        VIEW_RASTER,
+        VIEW_RAYMARCH,
+        VIEW_SOFTWARE,
+        VIEW_RENDERER_COUNT
     };
 
     enum InputKeyState {
@@ -53,21 +88,154 @@ public:
 
     static Game *Instance();
 
-    void update(float deltaTime);
-    void draw();
-    void processKeyInput(InputKey key, InputKeyState state);
+    // Runs as many fixed length ticks as fit in the time that passed, the rest carries over to the next frame
+    void update(double frameTime);
+    // Called once per press and once per release. The keys that do not steer a player, like the reset,
+    // are only taken from the first one and act as they are pressed.
+    void processKeyInput(InputKey key, InputKeyState state, int player = 0);
+    // Turns the first player, the others steer with their keys alone. The movement is only added up
+    // here and turns the player once at the next tick, however many events the mouse sends.
     void processMouseInput(double xPos, double yPos);
+
+    // Draws the latest published snapshot, from the thread the GL context is current on
+    void draw();
+
+    // In the render on demand mode a frame is only drawn when something changed, rather than continuously
+    bool rendersOnDemand() const;
+    void setRenderOnDemand(bool onDemand);
+    // Whether the player neither moves nor turns, so that nothing changes until the next input
+    bool isIdle() const;
+    // Blocks the render thread until a frame that differs from the last one is published, a redraw is
+    // requested or the timeout passes, and returns whether there is anything new to draw
+    bool waitForFrame(double timeout);
+    // Makes the next waitForFrame return right away, from any thread
+    void requestRedraw();
+    // Whether the picture changes without any input, because the maze is still loading or the HUD shows live numbers
+    bool isAnimating() const;
+    // Draws the 3D view at the resolution that keeps the frame within FRAME_TIME_BUDGET, scaled up to the viewport
+    void setDynamicResolution(bool enabled);
+    // Draws the minimap walls from a bitmask texture rather than a line mesh, from the next maze on
+    void setMinimapBitmask(bool enabled);
+    // Shows 2^zoom times fewer cells across the minimap, centered on the first player
+    void setMinimapZoom(int zoom);
+    // Picks how the 3D view is drawn, for comparing them on the same frames
+    void setViewRenderer(ViewRenderer renderer);
+    // Splits the window between up to MAX_PLAYERS players, who start from different corners of the maze
+    void setPlayerCount(int count);
+
+    // Generates a new maze from the given seed, so that a run can be reproduced
+    void restart(unsigned int seed);
+    // Eye positions at the cell centers, in the order a depth first walk through the whole maze visits them
+    std::vector<glm::vec3> tourPath() const;
+    void placePlayer(const glm::vec3 &position, float yaw, float pitch, int player = 0);
+    // Keeps the runs of the players so far as ghosts to race against and starts them over in the same maze.
+    // A new maze drops the ghosts.
+    void restartRun();
+    // Races a run recorded elsewhere, one sample per tick from the start of the current run
+    void addGhost(const Trajectory &trajectory);
+    // Blocks until the work started in the background for the current maze is done, from the render thread
+    void finishBackgroundWork();
     
 private:
+    // A generated maze, which is never modified once published. A reset publishes a new one.
+    struct MazeLayout {
+        bool walls[MAZE_HEIGHT * 2 - 1][MAZE_WIDTH];
+        std::vector<Light> torches;
+        // the share of the sides of each cell that are walls out of 255, then level after level the mean of
+        // each 2x2 block of the one before, down to a single texel. These are the levels of a quadtree over the maze.
+        std::vector<std::vector<unsigned char> > occupancy;
+    };
+
+    // Everything the render thread needs to draw a frame
+    struct FrameSnapshot {
+        std::shared_ptr<const MazeLayout> layout;
+        // the first revealedCount cells of the log have been seen by a player
+        std::shared_ptr<const std::vector<int> > revealed;
+        int revealedCount;
+        int playerCount;
+        int minimapZoom;
+        PlayerPose previousPoses[MAX_PLAYERS];
+        PlayerPose poses[MAX_PLAYERS];
+        // fraction of a tick the simulation was past its last tick
+        float alpha;
+        bool showHud;
+        ViewRenderer viewRenderer;
+        std::shared_ptr<const std::vector<Trajectory> > ghosts;
+        // ticks since the run started, the ghosts are as far into theirs
+        int runTicks;
+    };
+
     Game();
     virtual ~Game();
 
+    void tick(float deltaTime);
+    void publishSnapshot();
     void generateMaze(MazeCell *cell);
+    void placeTorches(MazeLayout *layout);
+    void buildOccupancy(MazeLayout *layout);
     void resetMaze();
     void reset();
+    void spawnPlayers();
+    // Reveals the cells in sight of a player who entered a new cell since the last time
+    void explore();
+    void setGhosts(const std::shared_ptr<std::vector<Trajectory> > &ghosts);
+    // Whether any ghost has not reached the end of its run yet
+    bool ghostsRunning() const;
 
-    Minimap *m_minimap;
+    // Picks up the latest snapshot and rebuilds the GL resources if it brings a new maze
+    const FrameSnapshot &syncRenderState();
+
+    std::atomic<bool> m_renderOnDemand;
+    std::atomic<bool> m_dynamicResolution;
+    std::atomic<bool> m_minimapBitmask;
+
+    // simulation thread
+    Player *m_players[MAX_PLAYERS];
+    int m_playerCount;
+    int m_minimapZoom;
+    // the cell every player was last seen in, so that only a move to another one looks around
+    int m_playerCells[MAX_PLAYERS];
+    std::shared_ptr<const MazeLayout> m_layout;
+    std::vector<bool> m_explored;
+    // cell indices in the order they were revealed, never reallocated and only appended to past
+    // the published count, so the render thread reads the published part without a lock
+    std::shared_ptr<std::vector<int> > m_revealed;
+    int m_revealedCount;
+    double m_accumulator;
+    float m_alpha;
+    // the keys every player holds down, one bit per InputKey
+    std::bitset<KEY_COUNT> m_keys[MAX_PLAYERS];
+    // mouse movement gathered since the last tick
+    glm::vec2 m_mouseOffset;
+    bool m_showHud;
+    ViewRenderer m_viewRenderer;
+    // the poses of every player since the run started, and the runs kept from before
+    std::vector<Trajectory> m_recordings;
+    std::shared_ptr<const std::vector<Trajectory> > m_ghosts;
+    int m_runTicks;
+    // the samples of the longest ghost run
+    int m_ghostTicks;
+
+    // the last snapshot published, nothing is published while it stays the same
+    FrameSnapshot m_published;
+
+    TripleBuffer<FrameSnapshot> m_snapshots;
+    std::mutex m_frameMutex;
+    std::condition_variable m_frameCondition;
+    bool m_framePending;
+
+    // render thread
+    std::shared_ptr<const MazeLayout> m_renderedLayout;
+    std::shared_ptr<const std::vector<int> > m_renderedRevealed;
+    int m_renderedRevealedCount;
     Maze    *m_maze;
+    Minimap *m_minimap;
+    Hud     *m_hud;
+    DynamicResolution *m_resolution;
+    // made the first time the view is drawn on the CPU for the current maze
+    SoftwareRenderer *m_software;
+    GhostRenderer *m_ghostRenderer;
+    bool     m_animating;
 };
 
 #endif
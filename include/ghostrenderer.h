@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GHOSTRENDERER_H
+#define GHOSTRENDERER_H
+
+#include "maze.h"
+#include "trajectory.h"
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+// samples a row of the trajectory texture holds
+#define GHOST_TEXTURE_WIDTH 1024
+
+// Draws the recorded runs as markers that retrace them, in the 3D view and on the minimap. The samples
+// of every trajectory are uploaded once, one after the other, into a float texture. Each ghost is an
+// instance that looks up the two samples around the current tick and blends them in the vertex
+// shader, so the CPU does nothing per ghost and all of them are drawn with a single instanced draw.
+class GhostRenderer
+{
+public:
+    GhostRenderer();
+    virtual ~GhostRenderer();
+
+    // Uploads the trajectories, unless they are the ones already uploaded
+    void setGhosts(const std::shared_ptr<const std::vector<Trajectory> > &ghosts);
+    int ghostCount() const;
+    // Draws the ghosts into every view, as they were the given number of ticks into their runs.
+    // Ghosts past the end of their run are not drawn.
+    void draw(const std::vector<Maze::View> &views, float tick);
+    // Draws the ghosts as dots over the minimap, which shows the part of the maze from origin on,
+    // from 0 to 1 across it, magnified scale times
+    void drawMinimap(const glm::vec2 &origin, float scale, float tick);
+
+private:
+    std::shared_ptr<const std::vector<Trajectory> > m_ghosts;
+    // the samples, and the first sample and the sample count of each ghost as instanced attributes
+    unsigned int m_texture, m_VAO, m_VBO, m_instanceBuffer;
+    int m_count;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "profiler.h"
+
+#include <GL/glew.h>
+
+// Thin wrappers over the GL calls that bind, toggle or draw, each of which counts itself into the frame
+// the profiler is recording. The draws, triangles and state changes the HUD and profile.csv show are the
+// sum of these calls, so the frames make them through here rather than calling GL directly. Like the
+// rest of the frame statistics, they are only to be called from the render thread.
+namespace gl
+{
+
+inline unsigned int triangleCount(GLenum mode, GLsizei count)
+{
+    switch (mode) {
+        case GL_TRIANGLES:
+            return count / 3;
+        case GL_TRIANGLE_STRIP:
+        case GL_TRIANGLE_FAN:
+            return count > 2 ? count - 2 : 0;
+        default:
+            return 0;
+    }
+}
+
+inline void useProgram(GLuint program)
+{
+    glUseProgram(program);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void bindVertexArray(GLuint array)
+{
+    glBindVertexArray(array);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void bindBuffer(GLenum target, GLuint buffer)
+{
+    glBindBuffer(target, buffer);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void bindTexture(GLenum target, GLuint texture)
+{
+    glBindTexture(target, texture);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void bindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    glBindFramebuffer(target, framebuffer);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void enable(GLenum capability)
+{
+    glEnable(capability);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void disable(GLenum capability)
+{
+    glDisable(capability);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void blendFunc(GLenum source, GLenum destination)
+{
+    glBlendFunc(source, destination);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void blendFuncSeparate(GLenum sourceColor, GLenum destinationColor, GLenum sourceAlpha, GLenum destinationAlpha)
+{
+    glBlendFuncSeparate(sourceColor, destinationColor, sourceAlpha, destinationAlpha);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void depthMask(GLboolean flag)
+{
+    glDepthMask(flag);
+    Profiler::Instance()->countStateChanges(1);
+}
+
+inline void drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    glDrawArrays(mode, first, count);
+    Profiler::Instance()->countDraws(1, triangleCount(mode, count));
+}
+
+inline void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    glDrawArraysInstanced(mode, first, count, instances);
+    Profiler::Instance()->countDraws(1, triangleCount(mode, count) * instances);
+}
+
+inline void drawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    glDrawElements(mode, count, type, indices);
+    Profiler::Instance()->countDraws(1, triangleCount(mode, count));
+}
+
+inline void multiDrawElements(GLenum mode, const GLsizei *counts, GLenum type, const void *const *indices, GLsizei drawCount)
+{
+    glMultiDrawElements(mode, counts, type, indices, drawCount);
+    unsigned int triangles = 0;
+    for (GLsizei i = 0; i < drawCount; ++i) {
+        triangles += triangleCount(mode, counts[i]);
+    }
+    Profiler::Instance()->countDraws(drawCount, triangles);
+}
+
+// The commands are read from the bound indirect buffer on the GPU, so the caller passes the
+// triangles they draw, out of the copy it uploaded
+inline void multiDrawElementsIndirect(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount, GLsizei stride, unsigned int triangles)
+{
+    glMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+    Profiler::Instance()->countDraws(drawCount, triangles);
+}
+
+}
+
+#endif
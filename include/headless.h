@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "game.h"
+
+// Settings of a benchmark run without a window. The maze size is the one the game is built with,
+// e.g. make CFLAGS="-DMAZE_WIDTH=64 -DMAZE_HEIGHT=64".
+struct HeadlessOptions
+{
+    int width;
+    int height;
+    int frames;
+    // frames that are rendered before the measured ones, to leave shader compilation and uploads out
+    int warmupFrames;
+    unsigned int seed;
+    float cellsPerSecond;
+    // hash every that many frames, 0 to hash none
+    int hashInterval;
+    // players in split screen, spread out evenly along the same tour
+    int players;
+    // the minimap walls drawn from a bitmask texture instead of lines
+    bool minimapBitmask;
+    // times the bitmask minimap is zoomed in by a factor of two
+    int minimapZoom;
+    // how the 3D view is drawn
+    Game::ViewRenderer viewRenderer;
+    // where the last frame is written to as a binary PPM, NULL to write none
+    const char *dumpPath;
+    // printf pattern of the files every measured frame is captured to, NULL to capture none
+    const char *capturePattern;
+    // runs along the tour at different speeds, raced by the players
+    int ghosts;
+};
+
+// Fills in the options from the command line and returns whether --headless was given
+bool parseHeadlessOptions(int argc, char **argv, HeadlessOptions *options);
+
+// Flies the player through the maze in an offscreen framebuffer of an EGL surfaceless context and
+// prints the frame time percentiles, and the image hashes if requested, as JSON. Returns the exit code.
+int runHeadless(const HeadlessOptions &options);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HUD_H
+#define HUD_H
+
+#include <string>
+#include <vector>
+
+// Draws lines of text with a built in 5x7 bitmap font over a translucent background
+class Hud
+{
+public:
+    Hud();
+    virtual ~Hud();
+
+    // x and y are the top left corner of the text in normalized device coordinates
+    void draw(const std::vector<std::string> &lines, float x, float y);
+    // Width of the longest line in normalized device coordinates
+    float width(const std::vector<std::string> &lines) const;
+
+private:
+    unsigned int VBO, VAO;
+    unsigned int fontTexture;
+    unsigned int capacity;
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIGHTGRID_H
+#define LIGHTGRID_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Light
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    bool isStatic;
+};
+
+// Bins the lights into the maze cells they can reach through open walls, so that
+// every fragment only has to loop over the short list of lights of its own cell
+class LightGrid
+{
+public:
+    LightGrid(const bool *walls);
+    virtual ~LightGrid();
+
+    // Adds a light and returns the index it can be moved with
+    int add(const Light &light);
+    void move(int index, const glm::vec3 &position);
+    const std::vector<Light> &lights() const;
+    // Leaves the static lights out of the cell lists once they are baked into the lightmap
+    void setStaticBaked(bool baked);
+
+    // Rebuilds and uploads the per cell lists if any light was added or moved since the last call
+    void update();
+
+    // Binds the cell ranges, the light index lists and the light data to three consecutive texture units
+    void bind(int firstUnit);
+
+private:
+    const bool *m_walls;
+    std::vector<Light> m_lights;
+    bool m_dirty;
+    bool m_staticBaked;
+
+    // offset and count of every cell in the index list
+    unsigned int m_cellTexture;
+    unsigned int m_indexBuffer, m_indexTexture;
+    // position and radius, then color, of every light
+    unsigned int m_lightBuffer, m_lightTexture;
+
+    std::vector<std::vector<int> > m_cellLights;
+    std::vector<int> m_visited;
+    std::vector<int> m_queue;
+
+    void binLight(int index);
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include "lightgrid.h"
+
+#include <memory>
+
+struct LightmapJob;
+
+// Bakes the static lights and the ambient occlusion of the maze into a top down lightmap,
+// LIGHTMAP_TEXELS_PER_CELL texels per cell side, on the thread pool in the background.
+// Every texel stores the light reaching it in rgb and how open its surroundings are in alpha.
+class LightmapBaker
+{
+public:
+    LightmapBaker();
+    // Cancels the bake that is still running, if any
+    virtual ~LightmapBaker();
+
+    // Starts baking a copy of the walls and of the static lights, abandoning any previous bake
+    void start(const bool *walls, const std::vector<Light> &lights);
+
+    // Uploads the lightmap the first time it is called after the bake has finished and returns
+    // whether the lightmap is available
+    bool poll();
+    // Blocks until the bake that is running has finished
+    void wait();
+    unsigned int texture() const;
+
+private:
+    std::shared_ptr<LightmapJob> m_job;
+    unsigned int m_texture;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <GL/glew.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <deque>
+
+// Tells when the GL commands of a submitted job have been executed, so that the objects they
+// created or filled may be used on another context sharing them.
+class LoadTicket
+{
+    friend class ResourceLoader;
+public:
+    LoadTicket();
+    virtual ~LoadTicket();
+
+    // Never blocks. Once it returns true, objects the job touched must be bound again before use.
+    bool isReady();
+    // Blocks until the job has run and its fence has signalled
+    void wait();
+
+private:
+    std::atomic<bool> m_issued;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    GLsync m_fence;
+};
+
+// Runs resource uploads on a thread of its own with a context that shares its objects with the
+// render context, so that building and uploading big meshes and textures does not stall the frames.
+// Jobs run in the order they were submitted and every one of them is followed by a fence.
+class ResourceLoader
+{
+public:
+    static ResourceLoader *Instance();
+
+    // makeCurrent binds the shared context on the loader thread and doneCurrent releases it once it stops.
+    // Until the loader is started, submitted jobs run right away on the calling thread.
+    void start(const std::function<void()> &makeCurrent, const std::function<void()> &doneCurrent);
+    // Runs the jobs still queued and joins the loader thread
+    void stop();
+
+    // Queues a job that issues GL commands, the ticket tells when their results are available
+    std::shared_ptr<LoadTicket> submit(const std::function<void()> &job);
+
+private:
+    ResourceLoader();
+    virtual ~ResourceLoader();
+
+    void loaderLoop(std::function<void()> makeCurrent, std::function<void()> doneCurrent);
+
+    std::thread m_thread;
+    std::deque<std::pair<std::function<void()>, std::shared_ptr<LoadTicket> > > m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+};
+
+#endif
@@ -25,22 +25,114 @@
 #ifndef MAZE_H
 #define MAZE_H
 
-#include "player.h"
+#include "occlusion.h"
+#include "lightmap.h"
+#include "common.h"
+
+#include <GL/glew.h>
+#include <vector>
+#include <memory>
+
+// The ray marcher steps through cells of the same pitch as the maze cells, shifted back by a wall so
+// that each one holds the walls to its left and above it. One more column and row hold the right and
+// bottom outer walls.
+#define RAY_CELLS_X (MAZE_WIDTH + 1)
+#define RAY_CELLS_Y (MAZE_HEIGHT + 1)
+#define RAY_LEFT_WALL 1u
+#define RAY_TOP_WALL 2u
+// the column where walls meet, which every wall running into it is extended over
+#define RAY_CORNER 4u
+// the materials of the left wall, the top wall and the corner are kept in the next three bytes
+#define RAY_LEFT_MATERIAL_SHIFT 8
+#define RAY_TOP_MATERIAL_SHIFT 16
+#define RAY_CORNER_MATERIAL_SHIFT 24
+
+struct MazeMesh;
+class LoadTicket;
 
 class Maze
 {
     friend class Game;
 public:
 
-    Maze(bool *walls);
+    // What one player sees, in its own part of the framebuffer
+    struct View {
+        glm::mat4 view;
+        glm::vec3 eye;
+        // x, y, width and height in pixels
+        int viewport[4];
+    };
+
+    Maze(const bool *walls);
     virtual ~Maze();
 
-    void draw();
+    // Draws all views, up to MAX_PLAYERS, with a single submission where viewport arrays are
+    // supported and with one per view otherwise. Draws nothing until the loader has uploaded
+    // the mesh and the textures.
+    void draw(const std::vector<View> &views);
+    // Draws the same views without the mesh, as one full screen triangle per view that marches the
+    // ray of every pixel through a texture of the walls around each cell. The cost follows the
+    // pixel count and how far the rays travel, not the number of walls.
+    void drawRaymarched(const std::vector<View> &views);
+    // The perspective of a view drawn into a viewport of the given shape
+    static glm::mat4 perspective(float aspectRatio);
+    // Packs the walls around every cell of the ray marcher, RAY_CELLS_X by RAY_CELLS_Y of them row by row
+    static std::vector<GLuint> rayCells(const bool *walls);
+    // Blocks until the mesh and the textures are uploaded
+    void finishLoading();
     
+    // A contiguous range of the element buffer holding the faces of one region of the maze
+    // that point in the same direction
+    struct DrawRange {
+        GLuint firstIndex;
+        GLuint count;
+        glm::vec3 min;
+        glm::vec3 max;
+        glm::vec3 normal;
+    };
+
 private:
-    unsigned int VBO, VAO, EBO;
+    // Layout mandated by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    unsigned int VAO, indirectBuffer, viewIndexBuffer;
+    // the walls bordering each cell for the ray marcher, and the empty vertex array its triangle is drawn with
+    unsigned int raymarchTexture, raymarchVAO;
     unsigned int numPoints;
-    Player player;
+    std::shared_ptr<MazeMesh> mesh;
+    std::shared_ptr<LoadTicket> meshUpload;
+    LightGrid lights;
+    LightmapBaker lightmap;
+
+    // ranges[0] holds the floor, the ceiling and the outer walls and is always drawn
+    std::vector<DrawRange> ranges;
+    // bit i is set for the ranges visible in view i
+    std::vector<unsigned int> rangeViews;
+    std::vector<DrawElementsIndirectCommand> commands;
+
+    // the middle planes of the inner wall runs, the nearest of which are rasterized every frame
+    std::vector<Occluder> occluders;
+    std::vector<std::pair<float, const Occluder*> > occluderDistances;
+    std::vector<const Occluder*> nearestOccluders;
+    OcclusionBuffer occlusionBuffers[MAX_PLAYERS];
+
+    // Marks the ranges that intersect the view frustum, face the eye and are not hidden
+    // behind the nearest walls as visible in the view
+    void cullRanges(int viewIndex, const glm::mat4 &viewProjection, const glm::vec3 &eye);
+    // Submits the ranges visible in any of the views of the mask with a single multi-draw call,
+    // as one instance per view
+    void drawRanges(unsigned int viewMask);
+    // Binds the material arrays, the lightmap once baked and the light grid shared by both ways of
+    // drawing, and returns whether the lightmap is used
+    bool bindShading();
+    // Sets up the vertex array the first time the uploads are found to be done
+    bool isLoaded();
 };
 
 #endif
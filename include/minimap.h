@@ -25,21 +25,68 @@
 #ifndef MINIMAP_H
 #define MINIMAP_H
 
+#include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 
+#include <memory>
+#include <vector>
+
+struct MinimapMesh;
+class LoadTicket;
+
 class Minimap
 {
 public: 
-    Minimap(bool *walls, glm::vec3 *playerPos);
+    // The walls are either built into a line mesh on the loader, or packed into a bitmask texture of
+    // one bit per wall right away and drawn by a single fragment shader pass, whatever the maze size.
+    // The occupancy levels of the maze layout back the bitmask minimap where its cells get too small.
+    Minimap(const bool *walls, const std::vector<std::vector<unsigned char> > &occupancy, bool fromBitmask);
     virtual ~Minimap();
 
-    void update();
+    // The most the minimap zooms in, still showing a few cells across
+    static int maxZoom();
+    // Shows 2^zoom times fewer cells across
+    void setZoom(int zoom);
+    // Places a dot for each of the players in sight, up to MAX_PLAYERS, and moves the camera along with the first
+    void update(const glm::vec3 *playerPositions, int playerCount);
+    // The corner of the part of the maze shown, from 0 to 1 across the whole of it, and how many times
+    // it is magnified, for drawing over the minimap
+    void shownArea(glm::vec2 *origin, float *scale) const;
+    // Shows the walls around the given cells, only the rectangle around them is uploaded again
+    void reveal(const int *cells, int count);
+    // Draws nothing until the loader has uploaded the walls. The background and the line walls are
+    // drawn into a texture once and only copied over afterwards, unless the viewport changed
+    // or the camera of the zoomed in minimap moved.
     void draw();
+    // Blocks until the walls are uploaded
+    void finishLoading();
+    // Sets up the vertex array the first time the upload is found to be done
+    bool isLoaded();
     
 private:
-    unsigned int VBO, VAO, EBO, player_VBO, player_VAO;
+    unsigned int VAO, player_VBO, player_VAO;
     unsigned int numPoints;
-    glm::vec3 *playerPos;
+    int numPlayers;
+    unsigned int cacheFramebuffer, cacheTexture;
+    // the walls one bit each and the occupancy levels, none when the walls are drawn as lines
+    unsigned int wallTexture, occupancyTexture;
+    int zoom;
+    // the corner of the part of the maze shown, from 0 to 1 across the whole of it
+    glm::vec2 cameraOrigin;
+    // the viewport the cache was drawn for and the pixels of it the minimap covers
+    int cacheViewport[4];
+    int cacheRect[4];
+    // the zoom and camera the line walls were cached for
+    int cacheZoom;
+    glm::vec2 cacheOrigin;
+    // one byte per cell, unexplored cells only show the background
+    std::vector<unsigned char> explored;
+    unsigned int exploredTexture;
+    std::shared_ptr<MinimapMesh> mesh;
+    std::shared_ptr<LoadTicket> meshUpload;
+
+    void fitRect(const int *viewport);
+    void renderCache(const int *viewport);
 };
 
 #endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// A solid planar quad that hides whatever lies behind it
+struct Occluder
+{
+    glm::vec3 corners[4];
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// A low resolution depth buffer rasterized on the CPU, used to reject geometry
+// hidden behind the nearest walls before it is sent to the GPU
+class OcclusionBuffer
+{
+public:
+    OcclusionBuffer();
+    virtual ~OcclusionBuffer();
+
+    // Clears the buffer and rasterizes the occluders as seen through viewProjection
+    void render(const glm::mat4 &viewProjection, const std::vector<const Occluder*> &occluders);
+
+    // Returns false only if the box is completely hidden behind the rendered occluders. The occluders
+    // only fill the pixels they cover whole, at their farthest depth over each, so that nothing seen
+    // through a gap narrower than a pixel is hidden.
+    bool isBoxVisible(const glm::vec3 &min, const glm::vec3 &max) const;
+
+private:
+    // Screen space occluder, the quad clipped against the near plane into a convex polygon of up to
+    // five edges. Its edge functions and the plane for the depth are all of the form a * x + b * y + c.
+    struct Polygon {
+        float edgeA[5], edgeB[5], edgeC[5];
+        int edgeCount;
+        float depthA, depthB, depthC;
+        int minX, minY, maxX, maxY;
+    };
+
+    glm::mat4 m_viewProjection;
+    // inverse clip space w per pixel, so larger values are closer and the cleared buffer is infinitely far
+    float *m_depth;
+    std::vector<Polygon> m_polygons;
+
+    void setupPolygons(const std::vector<const Occluder*> &occluders);
+    void rasterizeBand(int firstRow, int lastRow);
+};
+
+#endif
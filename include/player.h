@@ -5,6 +5,20 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+// Where the camera is and where it looks at, which is all the renderer needs of the player
+struct PlayerPose
+{
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+
+    // Returns the view matrix calculated using Euler Angles and the LookAt Matrix
+    glm::mat4 getViewMatrix() const;
+    // The pose alpha of the way from this one to the next
+    PlayerPose interpolate(const PlayerPose &next, float alpha) const;
+    bool operator==(const PlayerPose &other) const;
+};
+
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
 class Player
 {
@@ -23,11 +37,12 @@ public:
 
     // Constructor with vectors
     Player(bool *walls);
-    // Returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    glm::mat4 getViewMatrix()
-    {
-        return glm::lookAt(Position, Position + Front, Up);
-    }
+    PlayerPose pose() const;
+    // The pose at the start of the last simulation tick, rendering interpolates from it to the current one
+    PlayerPose previousPose() const;
+
+    // Remembers the current pose as the one the next simulation tick starts from
+    void beginTick();
 
     // Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void processMovement(PlayerMovement direction, float deltaTime);
@@ -35,6 +50,9 @@ public:
     // Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
     void processRotation(float xoffset, float yoffset, GLboolean constrainPitch = true);
 
+    // Places the camera directly, without checking it against the walls
+    void setPose(const glm::vec3 &position, float yaw, float pitch);
+
 private:
     bool *m_walls;
 
@@ -46,6 +64,7 @@ private:
     // Euler Angles
     float Yaw;
     float Pitch;
+    PlayerPose PreviousPose;
     // Camera options
     float MovementSpeed;
     float MouseSensitivity;
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <time.h>
+
+// number of frames the averages shown on the HUD are taken over
+#define PROFILER_HISTORY 120
+
+// Collects the GPU time of every render pass, the CPU time of the main loop sections and the
+// draw calls, triangles and state changes of every frame, and the CPU utilisation of the process
+// once a second. Only the CPU utilisation is still sampled while disabled.
+// Everything but the CPU sections belongs to the render thread, the sections may be timed
+// from any thread and add up until the render thread closes its frame.
+class Profiler
+{
+public:
+    enum GpuPass {
+        GPU_MAZE,
+        GPU_MINIMAP,
+        GPU_HUD,
+        GPU_PASS_COUNT
+    };
+
+    enum CpuSection {
+        CPU_UPDATE,
+        CPU_DRAW,
+        CPU_SWAP,
+        CPU_SECTION_COUNT
+    };
+
+    static Profiler *Instance();
+
+    bool isEnabled() const;
+    // While enabled, the rolling averages are also appended to profile.csv once a second
+    void setEnabled(bool enabled);
+
+    // Times the GPU passes even while disabled, for the consumers of latestGpuMs
+    void setGpuTimingEnabled(bool enabled);
+    // The GPU time of the pass picked up by the last beginFrame, negative if none came in
+    float latestGpuMs(GpuPass pass) const;
+
+    // Picks up the GPU times of the frame before last, whose queries have had a whole frame to finish
+    void beginFrame();
+    void endFrame();
+
+    void beginGpu(GpuPass pass);
+    void endGpu(GpuPass pass);
+    void beginCpu(CpuSection section);
+    void endCpu(CpuSection section);
+
+    // Called by the wrappers in glstate.h as the calls are made
+    void countDraws(unsigned int draws, unsigned int triangles);
+    void countStateChanges(unsigned int changes);
+
+    // The averages of the last PROFILER_HISTORY frames, one line per row of the HUD
+    std::vector<std::string> report() const;
+
+private:
+    struct FrameStats {
+        float frameMs;
+        float gpuMs[GPU_PASS_COUNT];
+        float cpuMs[CPU_SECTION_COUNT];
+        unsigned int draws;
+        unsigned int triangles;
+        unsigned int stateChanges;
+    };
+
+    Profiler();
+    virtual ~Profiler();
+
+    FrameStats average() const;
+    void writeCsv();
+
+    std::atomic<bool> m_enabled;
+    bool m_gpuTiming;
+    unsigned long m_frame;
+    // two sets of queries, the one of the current frame and the one still in flight
+    unsigned int m_queries[2][GPU_PASS_COUNT];
+    bool m_issued[2][GPU_PASS_COUNT];
+    bool m_hasQueries;
+    float m_gpuMs[GPU_PASS_COUNT];
+    float m_latestGpuMs[GPU_PASS_COUNT];
+
+    std::chrono::steady_clock::time_point m_frameStart;
+    std::chrono::steady_clock::time_point m_cpuStart[CPU_SECTION_COUNT];
+    std::atomic<float> m_cpuMs[CPU_SECTION_COUNT];
+    std::chrono::steady_clock::time_point m_lastCsvWrite;
+    // CPU time of the whole process, all threads together, against the wall clock time since the last sample
+    std::chrono::steady_clock::time_point m_lastCpuSample;
+    clock_t m_lastCpuClock;
+    float m_cpuUsage;
+    FrameStats m_current;
+    FrameStats m_history[PROFILER_HISTORY];
+    unsigned int m_historySize;
+    unsigned int m_historyNext;
+    FILE *m_csv;
+};
+
+#endif
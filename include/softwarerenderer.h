@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOFTWARERENDERER_H
+#define SOFTWARERENDERER_H
+
+#include "maze.h"
+
+#include <vector>
+#include <stdint.h>
+
+// Draws the 3D view on the CPU, for hosts without a GPU. Wolfenstein style, one ray per column of
+// a view is walked through the cells of the ray marcher, the wall it hits is drawn as a vertical span
+// and the floor and the ceiling are cast above and below it. Looking up or down shears the columns
+// instead of tilting them. Only the player light and the ambient term are applied, with no normal
+// maps, lightmap or light grid, and every surface is textured with the first material.
+class SoftwareRenderer
+{
+public:
+    SoftwareRenderer(const bool *walls);
+    virtual ~SoftwareRenderer();
+
+    // Renders the views into the CPU framebuffer, which covers the current viewport, with the columns
+    // split across the thread pool, and blits it to the viewport
+    void draw(const std::vector<Maze::View> &views);
+
+    // The view a column belongs to, as the rays are cast
+    struct Camera;
+
+private:
+    std::vector<GLuint> m_cells;
+    // the framebuffer is filled column by column from the top, so every column is contiguous. It is
+    // uploaded as is and transposed back by the blit.
+    std::vector<uint32_t> m_columns;
+    int m_width, m_height;
+    unsigned int m_texture, m_VAO;
+    int m_textureWidth, m_textureHeight;
+    std::vector<float> m_rowDistances[MAX_PLAYERS];
+    std::vector<int> m_rowLevels[MAX_PLAYERS];
+
+    // Works out where every row of a view meets the floor or the ceiling
+    void prepareRows(int viewIndex, Camera *camera);
+    // Casts the ray of one column of the framebuffer and fills it from the top to the bottom of the view
+    void renderColumn(const Camera &camera, int column);
+    // Walks the ray from the eye through the cells and returns the distance along the view direction
+    // to the nearest wall, or a negative one if it leaves the maze
+    float castRay(const glm::vec2 &origin, const glm::vec2 &direction, glm::vec2 *normal) const;
+};
+
+#endif
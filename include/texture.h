@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+// Creates a texture array with one layer per image. If every image has a .ktx file next to it with
+// the same format and size, its prebuilt mip chain is uploaded as is, otherwise the images are decoded
+// and their mipmaps are generated on the GPU.
+unsigned int makeTextureArray(const char *const *texturePaths, int count);
+
+#endif
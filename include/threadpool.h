@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+
+class ThreadPool
+{
+public:
+    static ThreadPool *Instance();
+
+    // Number of threads that take part in a parallelFor, the calling thread included
+    unsigned int size() const;
+
+    // Runs job(0) ... job(count - 1) across the workers and the calling thread and returns once all of them are done
+    void parallelFor(int count, const std::function<void(int)> &job);
+
+    // Queues a task to run on one of the workers and returns immediately. The tasks still queued when
+    // the pool shuts down are dropped.
+    void submit(const std::function<void()> &task);
+
+    // Raised as the pool shuts down at exit, long running tasks check it to give up rather than hold up the exit
+    const std::atomic<bool> &stopping() const;
+
+private:
+    ThreadPool();
+    virtual ~ThreadPool();
+
+    void workerLoop();
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()> > m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::atomic<bool> m_stopping;
+};
+
+#endif
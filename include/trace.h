@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Scoped timeline zones, compiled in with -D TRACE (make trace) and to nothing otherwise.
+// Every thread records into a ring buffer of its own, so a zone costs two clock reads and
+// a store. traceDump writes what the rings hold as a Chrome trace, which chrome://tracing
+// and ui.perfetto.dev open.
+#ifdef TRACE
+
+#include <chrono>
+
+// number of zones every thread keeps, the oldest are overwritten first
+#define TRACE_RING_SIZE (1 << 16)
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// name has to be a string literal, only its address is recorded
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#define TRACE_DUMP(path) traceDump(path)
+
+void traceRecord(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+void traceThreadName(const char *name);
+void traceDump(const char *path);
+
+class TraceZone
+{
+public:
+    explicit TraceZone(const char *name)
+        : m_name(name), m_start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~TraceZone()
+    {
+        traceRecord(m_name, m_start, std::chrono::steady_clock::now());
+    }
+
+private:
+    const char *m_name;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_DUMP(path)
+
+#endif
+
+#endif
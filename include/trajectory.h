@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "player.h"
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <stdint.h>
+
+// steps a position coordinate is quantized to per unit, and a yaw per degree
+#define TRAJECTORY_POSITION_STEPS 1024
+#define TRAJECTORY_YAW_STEPS 16
+
+// The poses of a player over a run, one per simulation tick. The position and the yaw are quantized
+// and each sample only stores how far they moved since the one before, as zigzag varints behind a
+// byte that flags the components that moved. A sample that moves the same as the one before, which is
+// the case for most of them when standing still or running straight, takes that byte alone.
+class Trajectory
+{
+public:
+    Trajectory();
+
+    void record(const PlayerPose &pose);
+    // samples recorded
+    int size() const;
+    // bytes the encoded samples take
+    size_t byteSize() const;
+    // Appends every sample as the position and the yaw in radians, the pitch is not recorded
+    void decode(std::vector<glm::vec4> *samples) const;
+
+private:
+    std::vector<uint8_t> m_bytes;
+    int m_size;
+    // the last sample and the step to it, in quantized units
+    int32_t m_last[4];
+    int32_t m_delta[4];
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Hands values from one writer thread to one reader thread without locks. The writer fills
+// back() and publishes it, the reader picks up the latest published value with update().
+// Neither side ever waits for the other, values the reader did not get to are dropped.
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer()
+        : m_back(0), m_middle(1), m_front(2)
+    {
+    }
+
+    // Writer side
+    T &back()
+    {
+        return m_slots[m_back];
+    }
+
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side, returns whether a value was published since the last call
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T &front() const
+    {
+        return m_slots[m_front];
+    }
+
+private:
+    // the middle slot index carries a flag telling whether it was published after the reader last took it
+    static const unsigned int INDEX = 3;
+    static const unsigned int FRESH = 4;
+
+    T m_slots[3];
+    unsigned int m_back;
+    std::atomic<unsigned int> m_middle;
+    unsigned int m_front;
+};
+
+#endif
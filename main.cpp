@@ -2,20 +2,55 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <atomic>
 #include <iostream>
-#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <utility>
 
 #include "game.h"
+#include "headless.h"
+#include "framelimiter.h"
+#include "framecapture.h"
+#include "loader.h"
+#include "profiler.h"
+#include "trace.h"
 #include "common.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
-void processInput(GLFWwindow *window);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+void bindKeys(int players);
 
-float lastFrame = 0.0f;
+void renderLoop(GLFWwindow *window);
 
-int main()
+double lastFrame = 0.0;
+
+// shared between the input thread (main) and the render thread
+static std::atomic<bool> rendering(true);
+static std::atomic<int> framebufferWidth(SCR_WIDTH);
+static std::atomic<int> framebufferHeight(SCR_HEIGHT);
+static int playerCount = 1;
+static const char *capturePattern = NULL;
+
+// the action of the game and the player each GLFW key code stands for, an action of -1 for the keys that do nothing
+struct KeyBinding
+{
+    int action;
+    int player;
+};
+static KeyBinding keyBindings[GLFW_KEY_LAST + 1];
+
+int main(int argc, char **argv)
 {
+    TRACE_THREAD_NAME("main");
+    // benchmark without a window: ./maze_3d --headless [--width W] [--height H] [--frames N] [--seed S] [--hash-interval N] [--players N] [--dump FILE] [--capture PATTERN] [--ghosts N]
+    HeadlessOptions headlessOptions;
+    if (parseHeadlessOptions(argc, argv, &headlessOptions)) {
+        return runHeadless(headlessOptions);
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -33,6 +68,11 @@ int main()
         return -1;
     }
     glfwMakeContextCurrent(window);
+    // the framebuffer may be larger than the window, so the views take their shape from its actual size
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    framebufferWidth = width;
+    framebufferHeight = height;
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
 
@@ -45,46 +85,159 @@ int main()
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 #endif
 
-    // render loop
-    // -----------
+    // meshes and textures are uploaded on a loader thread, through the context of an invisible
+    // window that shares its objects with the one of the main window
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* loaderWindow = glfwCreateWindow(1, 1, "Maze 3D loader", NULL, window);
+    if (loaderWindow != NULL) {
+        ResourceLoader::Instance()->start([loaderWindow]() { glfwMakeContextCurrent(loaderWindow); },
+                                          []() { glfwMakeContextCurrent(NULL); });
+    }
+    else {
+        std::cout << "Failed to create the loader context, loading on the render thread" << std::endl;
+    }
 
+    // the render thread owns the context from here on, the main thread only handles
+    // window events and runs the simulation ticks
+    glfwMakeContextCurrent(NULL);
     Game *game = Game::Instance();
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
+    // ./maze_3d --on-demand only draws when something changed, F4 switches at any time
+    // ./maze_3d --native-resolution always draws the 3D view at the size of the window
+    // ./maze_3d --players N splits the window between N players
+    // ./maze_3d --minimap-bitmask draws the minimap walls from a bitmask texture instead of lines
+    // ./maze_3d --raymarch ray marches the 3D view instead of rasterizing the maze, F5 switches at any time
+    // ./maze_3d --software casts the 3D view on the CPU, the next one F5 switches to
+    // T starts the run over in the same maze, with the runs so far as ghosts to race against
+    // ./maze_3d --capture capture/frame_%05d.png writes every frame drawn to a numbered PNG, or PPM for any other extension
+    game->setDynamicResolution(true);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--on-demand") == 0) {
+            game->setRenderOnDemand(true);
+        }
+        else if (strcmp(argv[i], "--native-resolution") == 0) {
+            game->setDynamicResolution(false);
+        }
+        else if (strcmp(argv[i], "--players") == 0 && i + 1 < argc) {
+            playerCount = MIN(MAX(atoi(argv[++i]), 1), MAX_PLAYERS);
+            game->setPlayerCount(playerCount);
+        }
+        else if (strcmp(argv[i], "--minimap-bitmask") == 0) {
+            game->setMinimapBitmask(true);
+        }
+        else if (strcmp(argv[i], "--raymarch") == 0) {
+            game->setViewRenderer(Game::VIEW_RAYMARCH);
+        }
+        else if (strcmp(argv[i], "--software") == 0) {
+            game->setViewRenderer(Game::VIEW_SOFTWARE);
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePattern = argv[++i];
+            if (!FrameCapture::isValidPattern(capturePattern)) {
+                std::cout << "The capture pattern must take the frame number through a single integer conversion, e.g. frame_%05d.png" << std::endl;
+                capturePattern = NULL;
+            }
+        }
+    }
+    // the keys are only seen as they are pressed and released, rather than polled every loop
+    bindKeys(playerCount);
+    glfwSetKeyCallback(window, key_callback);
+    std::thread renderThread(renderLoop, window);
+
+    // input and simulation loop
+    // -------------------------
+    lastFrame = glfwGetTime();
     while (!glfwWindowShouldClose(window))
     {
-        float currentFrame = glfwGetTime();
-        float deltaTime = currentFrame - lastFrame;
+        double currentFrame = glfwGetTime();
+        double deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        // input
-        // -----
-        processInput(window);
-
-        // render
-        // ------
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         game->update(deltaTime);
-        game->draw();
- 
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+
+        // glfw: poll IO events (keys pressed/released, mouse moved etc.), waking up at least once per tick
+        // unless rendering on demand with nothing moving, when only the next event matters
+        // ------------------------------------------------------------------------------------------------
+        TRACE_ZONE("poll events");
+        bool idle = game->rendersOnDemand() && game->isIdle();
+        glfwWaitEventsTimeout(idle ? IDLE_WAIT_TIMEOUT : TICK_DURATION);
+        if (idle) {
+            // nothing moved while waiting, so the time is not simulated
+            lastFrame = glfwGetTime();
+        }
     }
 
+    rendering = false;
+    renderThread.join();
+    ResourceLoader::Instance()->stop();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
+    TRACE_DUMP("trace.json");
     return 0;
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-// ---------------------------------------------------------------------------------------------------------
-void processInput(GLFWwindow *window)
+// render loop: draws the latest published simulation state, at most MAX_FRAME_RATE times a second
+// ------------------------------------------------------------------------------------------------
+void renderLoop(GLFWwindow *window)
+{
+    TRACE_THREAD_NAME("render");
+    glfwMakeContextCurrent(window);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    Game *game = Game::Instance();
+    Profiler *profiler = Profiler::Instance();
+    FrameLimiter limiter(MAX_FRAME_RATE);
+    FrameCapture *capture = capturePattern ? new FrameCapture(capturePattern) : NULL;
+    // the viewport is set before the first frame, whatever size the framebuffer turned out to be
+    int viewportWidth = 0;
+    int viewportHeight = 0;
+    while (rendering)
+    {
+        // on demand, a frame is drawn when the simulation or the window changed, and now and then while the picture changes by itself
+        if (game->rendersOnDemand() && !game->waitForFrame(IDLE_REDRAW_INTERVAL) && !game->isAnimating()) {
+            continue;
+        }
+
+        profiler->beginFrame();
+        if (viewportWidth != framebufferWidth || viewportHeight != framebufferHeight) {
+            viewportWidth = framebufferWidth;
+            viewportHeight = framebufferHeight;
+            glViewport(0, 0, viewportWidth, viewportHeight);
+        }
+
+        // render
+        // ------
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        game->draw();
+        if (capture) {
+            capture->capture(viewportWidth, viewportHeight);
+        }
+
+        // glfw: swap buffers
+        // ------------------
+        profiler->beginCpu(Profiler::CPU_SWAP);
+        {
+            TRACE_ZONE("swap");
+            glfwSwapBuffers(window);
+        }
+        profiler->endCpu(Profiler::CPU_SWAP);
+        profiler->endFrame();
+        limiter.wait();
+    }
+    // the frames still in flight are written out while the context is current
+    delete capture;
+    glfwMakeContextCurrent(NULL);
+}
+
+// key bindings: fills the flat lookup from the GLFW key codes to the actions of the players
+// ----------------------------------------------------------------------------------------
+void bindKeys(int players)
 {
-    static const std::map<int, Game::InputKey> keysLookup = {
+    static const std::pair<int, Game::InputKey> firstPlayerKeys[] = {
         { GLFW_KEY_W, Game::KEY_UP_1 },
         { GLFW_KEY_S, Game::KEY_DOWN_1 },
         { GLFW_KEY_A, Game::KEY_LEFT_1 },
@@ -95,31 +248,72 @@ void processInput(GLFWwindow *window)
         { GLFW_KEY_RIGHT, Game::KEY_RIGHT_2 },
         { GLFW_KEY_E, Game::KEY_MOVE_UP },
         { GLFW_KEY_Q, Game::KEY_MOVE_DOWN },
-        { GLFW_KEY_R, Game::KEY_RESET }
+        { GLFW_KEY_R, Game::KEY_RESET },
+        { GLFW_KEY_F3, Game::KEY_TOGGLE_HUD },
+        { GLFW_KEY_F4, Game::KEY_TOGGLE_ON_DEMAND },
+        { GLFW_KEY_F5, Game::KEY_NEXT_VIEW_RENDERER },
+        { GLFW_KEY_T, Game::KEY_RESTART_RUN },
+        { GLFW_KEY_EQUAL, Game::KEY_MINIMAP_ZOOM_IN },
+        { GLFW_KEY_MINUS, Game::KEY_MINIMAP_ZOOM_OUT }
     };
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+    // in split screen the other players move with the arrows, IJKL and the numpad, turning with the sideways keys
+    static const int playerKeys[MAX_PLAYERS - 1][4] = {
+        { GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_LEFT, GLFW_KEY_RIGHT },
+        { GLFW_KEY_I, GLFW_KEY_K, GLFW_KEY_J, GLFW_KEY_L },
+        { GLFW_KEY_KP_8, GLFW_KEY_KP_5, GLFW_KEY_KP_4, GLFW_KEY_KP_6 }
+    };
+    static const Game::InputKey playerActions[4] = { Game::KEY_UP_1, Game::KEY_DOWN_1, Game::KEY_LEFT_2, Game::KEY_RIGHT_2 };
 
-    for (auto it = keysLookup.cbegin(); it != keysLookup.cend(); ++it) {
-        if (glfwGetKey(window, it->first) == GLFW_PRESS) {
-            Game::Instance()->processKeyInput(it->second, Game::KEY_STATE_PRESSED);
+    for (int key = 0; key <= GLFW_KEY_LAST; ++key) {
+        keyBindings[key].action = -1;
+        keyBindings[key].player = 0;
+    }
+    for (unsigned int i = 0; i < sizeof(firstPlayerKeys) / sizeof(firstPlayerKeys[0]); ++i) {
+        // the arrows belong to the second player then
+        Game::InputKey action = firstPlayerKeys[i].second;
+        if (players > 1 && action >= Game::KEY_UP_2 && action <= Game::KEY_RIGHT_2) {
+            continue;
         }
-        else if (glfwGetKey(window, it->first) == GLFW_RELEASE){
-            Game::Instance()->processKeyInput(it->second, Game::KEY_STATE_RELEASED);
+        keyBindings[firstPlayerKeys[i].first].action = action;
+    }
+    for (int player = 1; player < players; ++player) {
+        for (int i = 0; i < 4; ++i) {
+            keyBindings[playerKeys[player - 1][i]].action = playerActions[i];
+            keyBindings[playerKeys[player - 1][i]].player = player;
         }
     }
 }
 
+// glfw: whenever a key is pressed or released this callback function executes, the repeats of a held key are left out
+// --------------------------------------------------------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/)
+{
+    if (key < 0 || key > GLFW_KEY_LAST || action == GLFW_REPEAT) {
+        return;
+    }
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+        glfwSetWindowShouldClose(window, true);
+        return;
+    }
+    const KeyBinding &binding = keyBindings[key];
+    if (binding.action >= 0) {
+        Game::Instance()->processKeyInput((Game::InputKey)binding.action, action == GLFW_PRESS ? Game::KEY_STATE_PRESSED : Game::KEY_STATE_RELEASED, binding.player);
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+void framebuffer_size_callback(GLFWwindow* /*window*/, int width, int height)
 {
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    // The render thread owns the context, so it applies the new size itself.
+    framebufferWidth = width;
+    framebufferHeight = height;
+    Game::Instance()->requestRedraw();
 }
 
-void mouse_callback(GLFWwindow* window, double xpos, double ypos)
+void mouse_callback(GLFWwindow* /*window*/, double xpos, double ypos)
 {
     Game::Instance()->processMouseInput(xpos, ypos);
 }
\ No newline at end of file
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dynamicresolution.h"
+#include "console.h"
+#include "common.h"
+#include "glstate.h"
+#include "trace.h"
+
+#include <GL/glew.h>
+#include <math.h>
+#include <string.h>
+
+// frames between drawing the view and its timing coming in
+#define TIMING_LATENCY 2
+// the rest of the frame, the minimap and the HUD, is left this share of the budget
+#define BUDGET_HEADROOM 0.15f
+// how much of every new timing goes into the average
+#define TIMING_SMOOTHING 0.1f
+#define SETTLE_FRAMES 15
+// smaller changes than that are not worth the visible jump
+#define MIN_SCALE_STEP 0.05f
+
+DynamicResolution::DynamicResolution()
+    : m_framebuffer(0), m_allocatedWidth(0), m_allocatedHeight(0), m_outputFramebuffer(0), m_scale(1.0f), m_averageMs(0.0f), m_framesSinceChange(0)
+{
+    glGenFramebuffers(1, &m_framebuffer);
+    glGenRenderbuffers(2, m_renderbuffers);
+    memset(m_viewport, 0, sizeof(m_viewport));
+    CONSOLE_DEBUG("DynamicResolution [%p] created.", this);
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    glDeleteRenderbuffers(2, m_renderbuffers);
+    glDeleteFramebuffers(1, &m_framebuffer);
+    CONSOLE_DEBUG("DynamicResolution [%p] destroyed.", this);
+}
+
+void DynamicResolution::addTiming(float ms)
+{
+    // the frames still in flight when the scale changed were drawn at the old one
+    if (++m_framesSinceChange <= TIMING_LATENCY) {
+        m_averageMs = ms;
+        return;
+    }
+    m_averageMs += (ms - m_averageMs) * TIMING_SMOOTHING;
+    if (m_framesSinceChange < SETTLE_FRAMES || m_averageMs <= 0.0f) {
+        return;
+    }
+    // the cost of the view follows its pixel count, which goes with the square of the scale
+    const float budget = FRAME_TIME_BUDGET * (1.0f - BUDGET_HEADROOM);
+    float scale = MIN(MAX(m_scale * sqrtf(budget / m_averageMs), MIN_RENDER_SCALE), 1.0f);
+    bool atLimit = scale != m_scale && (scale == 1.0f || scale == MIN_RENDER_SCALE);
+    if (fabsf(scale - m_scale) >= MIN_SCALE_STEP || atLimit) {
+        CONSOLE_DEBUG("DynamicResolution [%p] took %.2f ms, scaling from %.2f to %.2f.", this, m_averageMs, m_scale, scale);
+        m_scale = scale;
+        m_framesSinceChange = 0;
+    }
+}
+
+void DynamicResolution::begin()
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_outputFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_viewport);
+    // the target always covers the whole viewport, the view only uses a corner of it
+    if (m_viewport[2] != m_allocatedWidth || m_viewport[3] != m_allocatedHeight) {
+        allocate(m_viewport[2], m_viewport[3]);
+    }
+
+    gl::bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, width(), height());
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DynamicResolution::end()
+{
+    TRACE_ZONE("upscale view");
+    gl::bindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    gl::bindFramebuffer(GL_DRAW_FRAMEBUFFER, m_outputFramebuffer);
+    glBlitFramebuffer(0, 0, width(), height(), m_viewport[0], m_viewport[1], m_viewport[0] + m_viewport[2], m_viewport[1] + m_viewport[3],
+                      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    gl::bindFramebuffer(GL_FRAMEBUFFER, m_outputFramebuffer);
+    glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+}
+
+int DynamicResolution::width() const
+{
+    return MAX((int)(m_allocatedWidth * m_scale), 1);
+}
+
+int DynamicResolution::height() const
+{
+    return MAX((int)(m_allocatedHeight * m_scale), 1);
+}
+
+void DynamicResolution::allocate(int width, int height)
+{
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        CONSOLE_ERROR("The %dx%d offscreen target is incomplete", width, height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, m_outputFramebuffer);
+    m_allocatedWidth = width;
+    m_allocatedHeight = height;
+    CONSOLE_DEBUG("DynamicResolution [%p] allocated %dx%d.", this, width, height);
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framecapture.h"
+#include "console.h"
+#include "trace.h"
+#include "common.h"
+#include "glstate.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+// how long a fence is waited on before checking it again, in nanoseconds
+#define FENCE_WAIT_TIMEOUT 1000000
+// the most a stored deflate block holds
+#define DEFLATE_BLOCK_SIZE 65535
+#define ADLER_MODULUS 65521
+// bytes the Adler-32 sums can take before they have to be reduced, not to overflow 32 bits
+#define ADLER_BLOCK_SIZE 5552
+
+static void writePng(FILE *file, const std::vector<unsigned char> &pixels, int width, int height);
+static void writeChunk(FILE *file, const char *type, const std::vector<unsigned char> &data);
+static void putBigEndian(std::vector<unsigned char> *data, uint32_t value);
+
+FrameCapture::FrameCapture(const std::string &pathPattern)
+    : m_pathPattern(pathPattern), m_nextSlot(0), m_frame(0), m_stopping(false), m_writeFailed(false)
+{
+    m_png = pathPattern.size() >= 4 && !strcasecmp(pathPattern.c_str() + pathPattern.size() - 4, ".png");
+    memset(m_slots, 0, sizeof(m_slots));
+    CONSOLE_DEBUG("FrameCapture [%p] created.", this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    finish();
+    for (int i = 0; i < CAPTURE_RING_SIZE; ++i) {
+        if (m_slots[i].buffer) {
+            glDeleteBuffers(1, &m_slots[i].buffer);
+        }
+    }
+    CONSOLE_DEBUG("FrameCapture [%p] destroyed.", this);
+}
+
+void FrameCapture::capture(int width, int height)
+{
+    TRACE_ZONE("capture frame");
+    if (!m_thread.joinable()) {
+        m_stopping = false;
+        m_thread = std::thread(&FrameCapture::writerLoop, this);
+    }
+
+    // the slot about to be reused holds the oldest frame, which the GPU has usually finished by now
+    Slot &slot = m_slots[m_nextSlot];
+    if (slot.fence) {
+        collect(slot);
+    }
+    if (!slot.buffer) {
+        glGenBuffers(1, &slot.buffer);
+    }
+    gl::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.width != width || slot.height != height) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+        slot.width = width;
+        slot.height = height;
+    }
+    // with a pack buffer bound, the read only queues a copy on the GPU and returns
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    gl::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = m_frame++;
+    m_nextSlot = (m_nextSlot + 1) % CAPTURE_RING_SIZE;
+}
+
+void FrameCapture::finish()
+{
+    for (int i = 0; i < CAPTURE_RING_SIZE; ++i) {
+        Slot &slot = m_slots[(m_nextSlot + i) % CAPTURE_RING_SIZE];
+        if (slot.fence) {
+            collect(slot);
+        }
+    }
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+int FrameCapture::capturedFrames() const
+{
+    return m_frame;
+}
+
+bool FrameCapture::isValidPattern(const std::string &pattern)
+{
+    int conversions = 0;
+    for (std::string::size_type i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+        if (++i < pattern.size() && pattern[i] == '%') {
+            continue;
+        }
+        // flags and a width, then the conversion itself
+        while (i < pattern.size() && pattern[i] && strchr("-+ #0", pattern[i])) {
+            ++i;
+        }
+        while (i < pattern.size() && isdigit((unsigned char)pattern[i])) {
+            ++i;
+        }
+        if (i >= pattern.size() || !pattern[i] || !strchr("diouxX", pattern[i])) {
+            return false;
+        }
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+void FrameCapture::collect(Slot &slot)
+{
+    // the flush bit makes sure the fence was sent to the GPU, otherwise the wait could last forever
+    GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        TRACE_ZONE("wait for capture");
+        do {
+            status = glClientWaitSync(slot.fence, 0, FENCE_WAIT_TIMEOUT);
+        } while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = 0;
+
+    Image image;
+    image.width = slot.width;
+    image.height = slot.height;
+    image.frame = slot.frame;
+    {
+        // a writer that falls behind holds the frames back rather than letting them pile up in memory
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_queue.size() < CAPTURE_QUEUE_SIZE; });
+        if (!m_spare.empty()) {
+            image.pixels = std::move(m_spare.back());
+            m_spare.pop_back();
+        }
+    }
+
+    image.pixels.resize(slot.width * slot.height * 4);
+    gl::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size(), GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(&image.pixels[0], pixels, image.pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    gl::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!pixels) {
+        CONSOLE_WARNING("Failed to map the pixels of frame %d", slot.frame);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_spare.push_back(std::move(image.pixels));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(image));
+    }
+    m_condition.notify_all();
+}
+
+void FrameCapture::writerLoop()
+{
+    TRACE_THREAD_NAME("capture");
+    for (;;) {
+        Image image;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            if (m_stopping && m_queue.empty()) {
+                break;
+            }
+            image = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_condition.notify_all();
+
+        write(image);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_spare.push_back(std::move(image.pixels));
+        }
+    }
+}
+
+void FrameCapture::write(const Image &image)
+{
+    TRACE_ZONE("write frame");
+    char path[1024];
+    snprintf(path, sizeof(path), m_pathPattern.c_str(), image.frame);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        if (!m_writeFailed) {
+            CONSOLE_WARNING("Failed to open %s, the frames are not written", path);
+            m_writeFailed = true;
+        }
+        return;
+    }
+    if (m_png) {
+        writePng(file, image.pixels, image.width, image.height);
+    }
+    else {
+        writePpm(file, image.pixels, image.width, image.height);
+    }
+    fclose(file);
+}
+
+void FrameCapture::writePpm(FILE *file, const std::vector<unsigned char> &pixels, int width, int height)
+{
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(width * 3);
+    for (int y = height - 1; y >= 0; --y) {
+        const unsigned char *source = &pixels[y * width * 4];
+        for (int x = 0; x < width; ++x) {
+            memcpy(&row[x * 3], source + x * 4, 3);
+        }
+        fwrite(&row[0], 1, row.size(), file);
+    }
+}
+
+// An RGB PNG whose image data is kept in stored deflate blocks. It is as big as the PPM, but writing
+// it costs no more than the checksums, which keeps the writer ahead of the frames.
+static void writePng(FILE *file, const std::vector<unsigned char> &pixels, int width, int height)
+{
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<unsigned char> header;
+    putBigEndian(&header, width);
+    putBigEndian(&header, height);
+    // 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing
+    static const unsigned char format[5] = { 8, 2, 0, 0, 0 };
+    header.insert(header.end(), format, format + sizeof(format));
+    writeChunk(file, "IHDR", header);
+
+    // every row starts with its filter type, none
+    std::vector<unsigned char> rows((width * 3 + 1) * height);
+    unsigned char *row = &rows[0];
+    for (int y = height - 1; y >= 0; --y) {
+        const unsigned char *source = &pixels[y * width * 4];
+        *row++ = 0;
+        for (int x = 0; x < width; ++x) {
+            memcpy(row, source + x * 4, 3);
+            row += 3;
+        }
+    }
+
+    // zlib header for a 32K window without a preset dictionary, then the blocks and the Adler-32 of the rows
+    std::vector<unsigned char> data;
+    data.reserve(rows.size() + rows.size() / DEFLATE_BLOCK_SIZE * 5 + 16);
+    data.push_back(0x78);
+    data.push_back(0x01);
+    for (size_t offset = 0; offset < rows.size(); offset += DEFLATE_BLOCK_SIZE) {
+        size_t length = MIN(rows.size() - offset, (size_t)DEFLATE_BLOCK_SIZE);
+        data.push_back(offset + length == rows.size() ? 1 : 0);
+        data.push_back(length & 0xff);
+        data.push_back(length >> 8);
+        data.push_back(~length & 0xff);
+        data.push_back((~length >> 8) & 0xff);
+        data.insert(data.end(), rows.begin() + offset, rows.begin() + offset + length);
+    }
+    uint32_t a = 1, b = 0;
+    for (size_t offset = 0; offset < rows.size(); offset += ADLER_BLOCK_SIZE) {
+        size_t end = MIN(rows.size(), offset + ADLER_BLOCK_SIZE);
+        for (size_t i = offset; i < end; ++i) {
+            a += rows[i];
+            b += a;
+        }
+        a %= ADLER_MODULUS;
+        b %= ADLER_MODULUS;
+    }
+    putBigEndian(&data, (b << 16) | a);
+    writeChunk(file, "IDAT", data);
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+}
+
+static void writeChunk(FILE *file, const char *type, const std::vector<unsigned char> &data)
+{
+    static uint32_t crcTable[256];
+    static bool crcTableBuilt = false;
+    if (!crcTableBuilt) {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            crcTable[n] = c;
+        }
+        crcTableBuilt = true;
+    }
+
+    std::vector<unsigned char> length;
+    putBigEndian(&length, data.size());
+    fwrite(&length[0], 1, length.size(), file);
+    fwrite(type, 1, 4, file);
+    if (!data.empty()) {
+        fwrite(&data[0], 1, data.size(), file);
+    }
+
+    // the checksum covers the type and the data
+    uint32_t crc = 0xffffffffu;
+    for (int i = 0; i < 4; ++i) {
+        crc = crcTable[(crc ^ (unsigned char)type[i]) & 0xff] ^ (crc >> 8);
+    }
+    for (size_t i = 0; i < data.size(); ++i) {
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    std::vector<unsigned char> checksum;
+    putBigEndian(&checksum, crc ^ 0xffffffffu);
+    fwrite(&checksum[0], 1, checksum.size(), file);
+}
+
+static void putBigEndian(std::vector<unsigned char> *data, uint32_t value)
+{
+    data->push_back(value >> 24);
+    data->push_back((value >> 16) & 0xff);
+    data->push_back((value >> 8) & 0xff);
+    data->push_back(value & 0xff);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framelimiter.h"
+#include "trace.h"
+
+#include <thread>
+
+// the part of the wait that is spun rather than slept, which covers the usual timer slack
+#define SPIN_DURATION std::chrono::microseconds(1500)
+
+FrameLimiter::FrameLimiter(double framesPerSecond)
+    : m_frameDuration(framesPerSecond > 0.0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond))
+                                            : std::chrono::steady_clock::duration::zero())
+{
+}
+
+void FrameLimiter::wait()
+{
+    if (m_frameDuration == std::chrono::steady_clock::duration::zero()) {
+        return;
+    }
+
+    TRACE_ZONE("limit frame rate");
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < m_nextFrame) {
+        if (m_nextFrame - now > SPIN_DURATION) {
+            std::this_thread::sleep_for(m_nextFrame - now - SPIN_DURATION);
+        }
+        while (std::chrono::steady_clock::now() < m_nextFrame) {
+            std::this_thread::yield();
+        }
+        now = m_nextFrame;
+    }
+    // after a frame that ran late the schedule starts over, rather than rushing the frames after it
+    m_nextFrame = now - m_nextFrame > m_frameDuration ? now + m_frameDuration : m_nextFrame + m_frameDuration;
+}
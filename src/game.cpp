@@ -25,13 +25,27 @@
 #include "game.h"
 #include "minimap.h"
 #include "maze.h"
+#include "hud.h"
+#include "dynamicresolution.h"
+#include "softwarerenderer.h"
+#include "ghostrenderer.h"
+#include "profiler.h"
+#include "threadpool.h"
+#include "trace.h"
 #include "console.h"
 #include "common.h"
 
 #include <time.h>
+#include <stdio.h>
 #include <stdlib.h> 
 #include <vector>
-#include <map>
+#include <string.h>
+
+// one torch for about every that many cells
+#define TORCH_SPARSITY 12
+#define TORCH_RADIUS (3.0f * (WALL_SIZE + WALL_THICKNESS))
+// runs kept to race against, the oldest are dropped first
+#define MAX_GHOSTS 512
 
 struct MazeCell
 {
@@ -43,13 +57,15 @@ struct MazeCell
 static float lastX;
 static float lastY;
 static bool firstMouse = true;
-static std::map<Game::InputKey, bool> keyStates;
 
 // use the even y indexes for the walls that separate the cells horizontally
 // and the odd y indexes for the walls that separate the cells vertically
 static bool walls[MAZE_HEIGHT * 2 - 1][MAZE_WIDTH];
 static MazeCell cells[MAZE_HEIGHT][MAZE_WIDTH];
 
+static void splitViewport(const GLint *viewport, int count, int index, int *rect);
+static bool isPassable(int x, int y, int dx, int dy);
+
 Game *Game::Instance()
 {
     static Game instance;
@@ -57,7 +73,10 @@ Game *Game::Instance()
 }
 
 Game::Game()
+    : m_renderOnDemand(false), m_dynamicResolution(false), m_minimapBitmask(false), m_playerCount(1), m_minimapZoom(0), m_revealedCount(0), m_accumulator(0.0), m_alpha(0.0f), m_mouseOffset(0.0f), m_showHud(false), m_viewRenderer(VIEW_RASTER),
+      m_runTicks(0), m_ghostTicks(0), m_published(), m_framePending(false), m_renderedRevealedCount(0), m_maze(NULL), m_minimap(NULL), m_hud(NULL), m_resolution(NULL), m_software(NULL), m_ghostRenderer(NULL), m_animating(true)
 {
+    memset(m_players, 0, sizeof(m_players));
     srand(time(0));
     // initialize maze cells
     for (int y = 0; y < MAZE_HEIGHT; ++y) {
@@ -82,36 +101,532 @@ Game::Game()
             }
         }
     }
-    resetMaze();
-    generateMaze(&cells[rand() % MAZE_HEIGHT][rand() % MAZE_WIDTH]);
-    m_maze = new Maze(walls[0]);
-    m_minimap = new Minimap(walls[0], &m_maze->player.Position);
+    // the GL resources are only created once the render thread draws the first snapshot
+    reset();
+    publishSnapshot();
 
     CONSOLE_DEBUG("Game [%p] created.", this);
 }
 
 Game::~Game()
 {
+    for (int i = 0; i < MAX_PLAYERS; ++i) {
+        delete m_players[i];
+    }
     delete m_minimap;
+    delete m_hud;
+    delete m_resolution;
+    delete m_software;
+    delete m_ghostRenderer;
     CONSOLE_DEBUG("Game [%p] destroyed.", this);
 }
 
 void Game::draw()
 {
-    m_maze->draw();
+    TRACE_ZONE("draw");
+    const FrameSnapshot &frame = syncRenderState();
+    if (!m_maze) {
+        return;
+    }
+
+    Profiler *profiler = Profiler::Instance();
+    if (profiler->isEnabled() != frame.showHud) {
+        profiler->setEnabled(frame.showHud);
+    }
+    bool scaled = m_dynamicResolution;
+    profiler->setGpuTimingEnabled(scaled);
+    if (scaled && !m_resolution) {
+        m_resolution = new DynamicResolution();
+    }
+    float viewMs = profiler->latestGpuMs(Profiler::GPU_MAZE);
+    if (scaled && viewMs >= 0.0f) {
+        m_resolution->addTiming(viewMs);
+    }
+
+    profiler->beginCpu(Profiler::CPU_DRAW);
+    profiler->beginGpu(Profiler::GPU_MAZE);
+    if (scaled) {
+        m_resolution->begin();
+    }
+    // the views split whatever the view is drawn into, so they are scaled along with it
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    std::vector<Maze::View> views(frame.playerCount);
+    glm::vec3 positions[MAX_PLAYERS];
+    for (int i = 0; i < frame.playerCount; ++i) {
+        PlayerPose pose = frame.previousPoses[i].interpolate(frame.poses[i], frame.alpha);
+        views[i].view = pose.getViewMatrix();
+        views[i].eye = positions[i] = pose.position;
+        splitViewport(viewport, frame.playerCount, i, views[i].viewport);
+    }
+    switch (frame.viewRenderer) {
+        case VIEW_RAYMARCH:
+            m_maze->drawRaymarched(views);
+            break;
+        case VIEW_SOFTWARE:
+            if (!m_software) {
+                m_software = new SoftwareRenderer(m_renderedLayout->walls[0]);
+            }
+            m_software->draw(views);
+            break;
+        default:
+            m_maze->draw(views);
+            break;
+    }
+    // the ghosts are as far into their runs as the players are into theirs, which are drawn alpha of the way into the last tick
+    float ghostTick = frame.runTicks - 1 + frame.alpha;
+    if (frame.ghosts && !m_ghostRenderer) {
+        m_ghostRenderer = new GhostRenderer();
+    }
+    if (m_ghostRenderer) {
+        m_ghostRenderer->setGhosts(frame.ghosts);
+        // the software view leaves no depth to hide them behind the walls, so they only show on the minimap then
+        if (frame.viewRenderer != VIEW_SOFTWARE) {
+            m_ghostRenderer->draw(views, ghostTick);
+        }
+    }
+    if (scaled) {
+        m_resolution->end();
+    }
+    profiler->endGpu(Profiler::GPU_MAZE);
+    profiler->beginGpu(Profiler::GPU_MINIMAP);
+    // the minimap is handed the cells revealed since the last frame, and all of them when the maze is new
+    if (frame.revealed != m_renderedRevealed) {
+        m_renderedRevealed = frame.revealed;
+        m_renderedRevealedCount = 0;
+    }
+    if (frame.revealedCount > m_renderedRevealedCount) {
+        m_minimap->reveal(&(*frame.revealed)[m_renderedRevealedCount], frame.revealedCount - m_renderedRevealedCount);
+        m_renderedRevealedCount = frame.revealedCount;
+    }
+    m_minimap->setZoom(frame.minimapZoom);
+    m_minimap->update(positions, frame.playerCount);
     m_minimap->draw();
+    if (m_ghostRenderer) {
+        glm::vec2 origin;
+        float scale;
+        m_minimap->shownArea(&origin, &scale);
+        m_ghostRenderer->drawMinimap(origin, scale, ghostTick);
+    }
+    profiler->endGpu(Profiler::GPU_MINIMAP);
+    if (profiler->isEnabled()) {
+        // below the minimap and lined up with its right edge, the numbers are those of the last frames
+        std::vector<std::string> report = profiler->report();
+        report.push_back(m_renderOnDemand ? "RENDER ON DEMAND" : "RENDER CONTINUOUS");
+        static const char *viewRendererNames[VIEW_RENDERER_COUNT] = { "MAZE RASTERIZED", "MAZE RAYMARCHED", "MAZE SOFTWARE" };
+        report.push_back(viewRendererNames[frame.viewRenderer]);
+        if (m_ghostRenderer && m_ghostRenderer->ghostCount() > 0) {
+            char line[32];
+            snprintf(line, sizeof(line), "GHOSTS %d", m_ghostRenderer->ghostCount());
+            report.push_back(line);
+        }
+        if (scaled) {
+            char line[32];
+            snprintf(line, sizeof(line), "VIEW %dX%d", m_resolution->width(), m_resolution->height());
+            report.push_back(line);
+        }
+        profiler->beginGpu(Profiler::GPU_HUD);
+        m_hud->draw(report, MINIMAP_X + MINIMAP_WIDTH - m_hud->width(report), MINIMAP_Y - MINIMAP_HEIGHT - 0.02f);
+        profiler->endGpu(Profiler::GPU_HUD);
+    }
+    profiler->endCpu(Profiler::CPU_DRAW);
+    // the lightmap poll uploads nothing more once it has returned true
+    m_animating = frame.showHud || !m_maze->isLoaded() || !m_minimap->isLoaded() || !m_maze->lightmap.poll();
 }
 
 void Game::reset()
 {
-    resetMaze();
-    generateMaze(&cells[rand() % MAZE_HEIGHT][rand() % MAZE_WIDTH]);
+    TRACE_ZONE("reset");
+    {
+        TRACE_ZONE("generate maze");
+        resetMaze();
+        generateMaze(&cells[rand() % MAZE_HEIGHT][rand() % MAZE_WIDTH]);
+    }
+    // the render thread may still be building from the previous layout, so the new one is a copy
+    std::shared_ptr<MazeLayout> layout = std::make_shared<MazeLayout>();
+    memcpy(layout->walls, walls, sizeof(walls));
+    placeTorches(layout.get());
+    buildOccupancy(layout.get());
+    m_layout = layout;
+    // every cell is revealed at most once, so the log never grows past the maze
+    m_explored.assign(MAZE_WIDTH * MAZE_HEIGHT, false);
+    m_revealed = std::make_shared<std::vector<int> >(MAZE_WIDTH * MAZE_HEIGHT);
+    m_revealedCount = 0;
+    // the runs of another maze are no use to race against
+    setGhosts(std::shared_ptr<std::vector<Trajectory> >());
+    spawnPlayers();
+
+    CONSOLE_DEBUG("Game [%p] was resetted.", this);
+}
+
+void Game::spawnPlayers()
+{
+    // the players after the first start from the other corners, looking along the outer wall
+    const float far = WALL_SIZE / 2.0f + (WALL_SIZE + WALL_THICKNESS) * (MAZE_WIDTH - 1);
+    const float deep = WALL_SIZE / 2.0f + (WALL_SIZE + WALL_THICKNESS) * (MAZE_HEIGHT - 1);
+    const glm::vec3 corners[MAX_PLAYERS - 1] = {
+        glm::vec3(far, WALL_SIZE / 2.0f, WALL_SIZE / 2.0f),
+        glm::vec3(WALL_SIZE / 2.0f, WALL_SIZE / 2.0f, deep),
+        glm::vec3(far, WALL_SIZE / 2.0f, deep)
+    };
+    const float yaws[MAX_PLAYERS - 1] = { 90.0f, -90.0f, 180.0f };
+    for (int i = 0; i < MAX_PLAYERS; ++i) {
+        delete m_players[i];
+        m_players[i] = NULL;
+        m_playerCells[i] = -1;
+        if (i < m_playerCount) {
+            m_players[i] = new Player(walls[0]);
+        }
+        if (i > 0 && i < m_playerCount) {
+            m_players[i]->setPose(corners[i - 1], yaws[i - 1], 0.0f);
+        }
+    }
+    // a run starts wherever the players are spawned
+    m_recordings.assign(m_playerCount, Trajectory());
+    for (int i = 0; i < m_playerCount; ++i) {
+        m_recordings[i].record(m_players[i]->pose());
+    }
+    m_runTicks = 0;
+}
+
+void Game::setPlayerCount(int count)
+{
+    m_playerCount = MIN(MAX(count, 1), MAX_PLAYERS);
+    spawnPlayers();
+    publishSnapshot();
+}
+
+void Game::restart(unsigned int seed)
+{
+    srand(seed);
+    reset();
+    publishSnapshot();
+}
+
+void Game::explore()
+{
+    static const int directions[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    const float cellSize = WALL_SIZE + WALL_THICKNESS;
+    for (int i = 0; i < m_playerCount; ++i) {
+        glm::vec3 position = m_players[i]->pose().position;
+        int x = MIN(MAX((int)(position.x / cellSize), 0), MAZE_WIDTH - 1);
+        int y = MIN(MAX((int)(position.z / cellSize), 0), MAZE_HEIGHT - 1);
+        if (y * MAZE_WIDTH + x == m_playerCells[i]) {
+            continue;
+        }
+        m_playerCells[i] = y * MAZE_WIDTH + x;
+
+        // the cell of the player and down the corridors in the four directions, as far as the first wall
+        auto reveal = [this](int cellX, int cellY) {
+            int cell = cellY * MAZE_WIDTH + cellX;
+            if (!m_explored[cell]) {
+                m_explored[cell] = true;
+                (*m_revealed)[m_revealedCount++] = cell;
+            }
+        };
+        reveal(x, y);
+        for (int d = 0; d < 4; ++d) {
+            int cellX = x, cellY = y;
+            while (isPassable(cellX, cellY, directions[d][0], directions[d][1])) {
+                cellX += directions[d][0];
+                cellY += directions[d][1];
+                reveal(cellX, cellY);
+            }
+        }
+    }
+}
+
+void Game::restartRun()
+{
+    std::shared_ptr<std::vector<Trajectory> > ghosts = m_ghosts ? std::make_shared<std::vector<Trajectory> >(*m_ghosts)
+                                                                : std::make_shared<std::vector<Trajectory> >();
+    for (std::vector<Trajectory>::const_iterator it = m_recordings.cbegin(); it != m_recordings.cend(); ++it) {
+        // a player who was never given a tick has nothing to replay
+        if (it->size() > 1) {
+            ghosts->push_back(*it);
+        }
+    }
+    if (ghosts->size() > MAX_GHOSTS) {
+        ghosts->erase(ghosts->begin(), ghosts->end() - MAX_GHOSTS);
+    }
+    setGhosts(ghosts);
+    spawnPlayers();
+    publishSnapshot();
+}
+
+void Game::addGhost(const Trajectory &trajectory)
+{
+    std::shared_ptr<std::vector<Trajectory> > ghosts = m_ghosts ? std::make_shared<std::vector<Trajectory> >(*m_ghosts)
+                                                                : std::make_shared<std::vector<Trajectory> >();
+    ghosts->push_back(trajectory);
+    if (ghosts->size() > MAX_GHOSTS) {
+        ghosts->erase(ghosts->begin());
+    }
+    setGhosts(ghosts);
+    publishSnapshot();
+}
+
+void Game::setGhosts(const std::shared_ptr<std::vector<Trajectory> > &ghosts)
+{
+    // the render thread may still be drawing the ghosts published before, so they are replaced rather than added to
+    m_ghosts = ghosts;
+    m_ghostTicks = 0;
+    if (ghosts) {
+        for (std::vector<Trajectory>::const_iterator it = ghosts->cbegin(); it != ghosts->cend(); ++it) {
+            m_ghostTicks = MAX(m_ghostTicks, it->size());
+        }
+    }
+}
+
+bool Game::ghostsRunning() const
+{
+    return m_ghosts && m_runTicks <= m_ghostTicks;
+}
+
+void Game::publishSnapshot()
+{
+    explore();
+    FrameSnapshot next;
+    next.layout = m_layout;
+    next.revealed = m_revealed;
+    next.revealedCount = m_revealedCount;
+    next.playerCount = m_playerCount;
+    next.minimapZoom = m_minimapZoom;
+    next.alpha = m_alpha;
+    next.showHud = m_showHud;
+    next.viewRenderer = m_viewRenderer;
+    next.ghosts = m_ghosts;
+    next.runTicks = m_runTicks;
+    bool running = ghostsRunning();
+    bool changed = next.layout != m_published.layout || next.showHud != m_published.showHud || next.playerCount != m_published.playerCount ||
+                   next.revealedCount != m_published.revealedCount || next.minimapZoom != m_published.minimapZoom || next.viewRenderer != m_published.viewRenderer ||
+                   next.ghosts != m_published.ghosts || (running && (next.runTicks != m_published.runTicks || next.alpha != m_published.alpha));
+    for (int i = 0; i < m_playerCount; ++i) {
+        next.previousPoses[i] = m_players[i]->previousPose();
+        next.poses[i] = m_players[i]->pose();
+        // the alpha only matters while a player is between two different poses
+        changed = changed || !(next.poses[i] == m_published.poses[i]) || !(next.previousPoses[i] == m_published.previousPoses[i]) ||
+                  (!(next.poses[i] == next.previousPoses[i]) && next.alpha != m_published.alpha);
+    }
+    if (!changed) {
+        return;
+    }
+
+    m_published = next;
+    m_snapshots.back() = next;
+    m_snapshots.publish();
+    requestRedraw();
+}
+
+bool Game::rendersOnDemand() const
+{
+    return m_renderOnDemand;
+}
+
+void Game::setRenderOnDemand(bool onDemand)
+{
+    m_renderOnDemand = onDemand;
+    requestRedraw();
+}
+
+bool Game::isIdle() const
+{
+    // the keys from KEY_UP_1 to KEY_MOVE_DOWN move or turn a player
+    static const std::bitset<KEY_COUNT> motionKeys((1u << (KEY_MOVE_DOWN + 1)) - 1);
+    for (int player = 0; player < m_playerCount; ++player) {
+        if ((m_keys[player] & motionKeys).any()) {
+            return false;
+        }
+        if (!(m_players[player]->pose() == m_players[player]->previousPose())) {
+            return false;
+        }
+    }
+    // the ghosts keep moving by themselves
+    if (ghostsRunning()) {
+        return false;
+    }
+    return m_mouseOffset == glm::vec2(0.0f);
+}
+
+bool Game::waitForFrame(double timeout)
+{
+    std::unique_lock<std::mutex> lock(m_frameMutex);
+    m_frameCondition.wait_for(lock, std::chrono::duration<double>(timeout), [this]() { return m_framePending; });
+    bool pending = m_framePending;
+    m_framePending = false;
+    return pending;
+}
+
+void Game::requestRedraw()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_framePending = true;
+    }
+    m_frameCondition.notify_one();
+}
+
+bool Game::isAnimating() const
+{
+    return m_animating;
+}
+
+void Game::setDynamicResolution(bool enabled)
+{
+    m_dynamicResolution = enabled;
+}
+
+void Game::setMinimapBitmask(bool enabled)
+{
+    m_minimapBitmask = enabled;
+}
+
+void Game::setViewRenderer(ViewRenderer renderer)
+{
+    m_viewRenderer = renderer;
+}
+
+void Game::setMinimapZoom(int zoom)
+{
+    m_minimapZoom = MIN(MAX(zoom, 0), Minimap::maxZoom());
+}
+
+const Game::FrameSnapshot &Game::syncRenderState()
+{
+    m_snapshots.update();
+    const FrameSnapshot &frame = m_snapshots.front();
+    if (!frame.layout || frame.layout == m_renderedLayout) {
+        return frame;
+    }
+
+    // the layout stays alive as long as the resources built from it, which keep pointers to its walls
     delete m_minimap;
     delete m_maze;
-    m_maze = new Maze(walls[0]);
-    m_minimap = new Minimap(walls[0], &m_maze->player.Position);
+    delete m_software;
+    m_software = NULL;
+    m_renderedLayout = frame.layout;
+    const bool *layoutWalls = m_renderedLayout->walls[0];
+    m_maze = new Maze(layoutWalls);
+    m_minimap = new Minimap(layoutWalls, m_renderedLayout->occupancy, m_minimapBitmask);
+    if (!m_hud) {
+        m_hud = new Hud();
+    }
+    for (std::vector<Light>::const_iterator it = m_renderedLayout->torches.cbegin(); it != m_renderedLayout->torches.cend(); ++it) {
+        m_maze->lights.add(*it);
+    }
+    // the torches never move, so their light is baked in the background and the maze switches over once it is done
+    m_maze->lightmap.start(layoutWalls, m_maze->lights.lights());
+    return frame;
+}
 
-    CONSOLE_DEBUG("Game [%p] was resetted.", this);
+std::vector<glm::vec3> Game::tourPath() const
+{
+    std::vector<glm::vec3> path;
+    std::vector<bool> visited(MAZE_WIDTH * MAZE_HEIGHT, false);
+    std::vector<int> stack(1, 0);
+    visited[0] = true;
+    while (!stack.empty()) {
+        int cell = stack.back(), x = cell % MAZE_WIDTH, y = cell / MAZE_WIDTH;
+        path.push_back(glm::vec3(x * (WALL_SIZE + WALL_THICKNESS) + WALL_SIZE / 2.0f,
+                                 WALL_SIZE / 2.0f,
+                                 y * (WALL_SIZE + WALL_THICKNESS) + WALL_SIZE / 2.0f));
+
+        // the maze is a spanning tree, so going back the way we came is the only way to reach the other branches
+        const int neighbors[4][3] = {
+            { x - 1, y, x > 0 && !walls[y * 2][x] },
+            { x + 1, y, x < MAZE_WIDTH - 1 && !walls[y * 2][x + 1] },
+            { x, y - 1, y > 0 && !walls[y * 2 - 1][x] },
+            { x, y + 1, y < MAZE_HEIGHT - 1 && !walls[y * 2 + 1][x] }
+        };
+        int next = -1;
+        for (int n = 0; n < 4 && next < 0; ++n) {
+            if (neighbors[n][2] && !visited[neighbors[n][1] * MAZE_WIDTH + neighbors[n][0]]) {
+                next = neighbors[n][1] * MAZE_WIDTH + neighbors[n][0];
+            }
+        }
+        if (next >= 0) {
+            visited[next] = true;
+            stack.push_back(next);
+        }
+        else {
+            stack.pop_back();
+        }
+    }
+    return path;
+}
+
+void Game::placePlayer(const glm::vec3 &position, float yaw, float pitch, int player)
+{
+    if (player >= m_playerCount) {
+        return;
+    }
+    m_players[player]->setPose(position, yaw, pitch);
+    publishSnapshot();
+}
+
+void Game::finishBackgroundWork()
+{
+    syncRenderState();
+    if (m_maze) {
+        m_maze->finishLoading();
+        m_minimap->finishLoading();
+        m_maze->lightmap.wait();
+    }
+}
+
+void Game::placeTorches(MazeLayout *layout)
+{
+    for (int i = 0; i < MAZE_WIDTH * MAZE_HEIGHT / TORCH_SPARSITY; ++i) {
+        Light torch;
+        torch.position = glm::vec3((rand() % MAZE_WIDTH + 0.5f) * (WALL_SIZE + WALL_THICKNESS) - HALF_WALL_THICKNESS,
+                                   WALL_SIZE * 0.8f,
+                                   (rand() % MAZE_HEIGHT + 0.5f) * (WALL_SIZE + WALL_THICKNESS) - HALF_WALL_THICKNESS);
+        torch.radius = TORCH_RADIUS;
+        torch.color = glm::vec3(1.0f, 0.6f, 0.25f);
+        torch.isStatic = true;
+        layout->torches.push_back(torch);
+    }
+}
+
+void Game::buildOccupancy(MazeLayout *layout)
+{
+    TRACE_ZONE("build occupancy");
+    std::vector<std::vector<unsigned char> > &levels = layout->occupancy;
+    levels.assign(1, std::vector<unsigned char>(MAZE_WIDTH * MAZE_HEIGHT));
+    // the outer sides count as walls, the odd rows hold the walls between a row of cells and the next
+    std::vector<unsigned char> &cellLevel = levels[0];
+    ThreadPool::Instance()->parallelFor(MAZE_HEIGHT, [layout, &cellLevel](int y) {
+        for (int x = 0; x < MAZE_WIDTH; ++x) {
+            int sides = (x == 0 || layout->walls[y * 2][x]) + (x == MAZE_WIDTH - 1 || layout->walls[y * 2][x + 1]) +
+                        (y == 0 || layout->walls[y * 2 - 1][x]) + (y == MAZE_HEIGHT - 1 || layout->walls[y * 2 + 1][x]);
+            cellLevel[y * MAZE_WIDTH + x] = sides * 255 / 4;
+        }
+    });
+
+    // the sizes halve the way those of mipmaps do, so the last row or column of an odd level is merged into the one before
+    int width = MAZE_WIDTH, height = MAZE_HEIGHT;
+    while (width > 1 || height > 1) {
+        const std::vector<unsigned char> &below = levels.back();
+        int belowWidth = width, belowHeight = height;
+        width = MAX(width / 2, 1);
+        height = MAX(height / 2, 1);
+        std::vector<unsigned char> level(width * height);
+        ThreadPool::Instance()->parallelFor(height, [&below, &level, belowWidth, belowHeight, width, height](int y) {
+            int top = y * 2, bottom = y == height - 1 ? belowHeight : MIN(top + 2, belowHeight);
+            for (int x = 0; x < width; ++x) {
+                int left = x * 2, right = x == width - 1 ? belowWidth : MIN(left + 2, belowWidth);
+                int sum = 0;
+                for (int j = top; j < bottom; ++j) {
+                    for (int i = left; i < right; ++i) {
+                        sum += below[j * belowWidth + i];
+                    }
+                }
+                int count = (bottom - top) * (right - left);
+                level[y * width + x] = (sum + count / 2) / count;
+            }
+        });
+        levels.push_back(level);
+    }
 }
 
 void Game::generateMaze(MazeCell *cell)
@@ -153,58 +668,110 @@ void Game::resetMaze()
     }
 }
 
-void Game::update(float deltaTime)
+void Game::update(double frameTime)
 {
-    if (keyStates[KEY_UP_1]) {
-        m_maze->player.processMovement(Player::FORWARD, deltaTime);
-    }
-    if (keyStates[KEY_DOWN_1]) {
-        m_maze->player.processMovement(Player::BACKWARD, deltaTime);
+    TRACE_ZONE("update");
+    Profiler::Instance()->beginCpu(Profiler::CPU_UPDATE);
+    m_accumulator += MIN(frameTime, MAX_FRAME_TIME);
+    while (m_accumulator >= TICK_DURATION) {
+        tick(TICK_DURATION);
+        m_accumulator -= TICK_DURATION;
     }
-    if (keyStates[KEY_LEFT_1]) {
-        m_maze->player.processMovement(Player::LEFT, deltaTime);
-    }
-    if (keyStates[KEY_RIGHT_1]) {
-        m_maze->player.processMovement(Player::RIGHT, deltaTime);
-    }
-    if (keyStates[KEY_MOVE_UP]) {
-        m_maze->player.processMovement(Player::UP, deltaTime);
-    }
-    if (keyStates[KEY_MOVE_DOWN]) {
-        m_maze->player.processMovement(Player::DOWN, deltaTime);
-    }
-    if (keyStates[KEY_UP_2]) {
-        m_maze->player.processRotation(0, 1000 * deltaTime);
+    m_alpha = m_accumulator / TICK_DURATION;
+    publishSnapshot();
+    Profiler::Instance()->endCpu(Profiler::CPU_UPDATE);
+}
+
+void Game::tick(float deltaTime)
+{
+    for (int i = 0; i < m_playerCount; ++i) {
+        m_players[i]->beginTick();
     }
-    if (keyStates[KEY_DOWN_2]) {
-        m_maze->player.processRotation(0, -1000 * deltaTime);
+    if (m_mouseOffset != glm::vec2(0.0f)) {
+        m_players[0]->processRotation(m_mouseOffset.x * 3, m_mouseOffset.y);
+        m_mouseOffset = glm::vec2(0.0f);
     }
-    if (keyStates[KEY_LEFT_2]) {
-        m_maze->player.processRotation(-1000 * deltaTime, 0);
+    for (int i = 0; i < m_playerCount; ++i) {
+        Player *player = m_players[i];
+        const std::bitset<KEY_COUNT> &keys = m_keys[i];
+        if (keys.test(KEY_UP_1)) {
+            player->processMovement(Player::FORWARD, deltaTime);
+        }
+        if (keys.test(KEY_DOWN_1)) {
+            player->processMovement(Player::BACKWARD, deltaTime);
+        }
+        if (keys.test(KEY_LEFT_1)) {
+            player->processMovement(Player::LEFT, deltaTime);
+        }
+        if (keys.test(KEY_RIGHT_1)) {
+            player->processMovement(Player::RIGHT, deltaTime);
+        }
+        if (keys.test(KEY_MOVE_UP)) {
+            player->processMovement(Player::UP, deltaTime);
+        }
+        if (keys.test(KEY_MOVE_DOWN)) {
+            player->processMovement(Player::DOWN, deltaTime);
+        }
+        if (keys.test(KEY_UP_2)) {
+            player->processRotation(0, 1000 * deltaTime);
+        }
+        if (keys.test(KEY_DOWN_2)) {
+            player->processRotation(0, -1000 * deltaTime);
+        }
+        if (keys.test(KEY_LEFT_2)) {
+            player->processRotation(-1000 * deltaTime, 0);
+        }
+        if (keys.test(KEY_RIGHT_2)) {
+            player->processRotation(1000 * deltaTime, 0);
+        }
     }
-    if (keyStates[KEY_RIGHT_2]) {
-        m_maze->player.processRotation(1000 * deltaTime, 0);
+    for (int i = 0; i < m_playerCount; ++i) {
+        m_recordings[i].record(m_players[i]->pose());
     }
-    m_minimap->update();
+    ++m_runTicks;
 }
 
-void Game::processKeyInput(InputKey key, InputKeyState state)
+void Game::processKeyInput(InputKey key, InputKeyState state, int player)
 {
+    TRACE_ZONE("key input");
+    if (player < 0 || player >= MAX_PLAYERS) {
+        return;
+    }
+    std::bitset<KEY_COUNT> &keys = m_keys[player];
     // conditional to handle undesired continuous key events
-    if (!keyStates[key] && state == KEY_STATE_PRESSED) {
+    if (player == 0 && !keys.test(key) && state == KEY_STATE_PRESSED) {
         switch (key) {
             case KEY_RESET:
                 reset();
                 break;
+            case KEY_TOGGLE_HUD:
+                m_showHud = !m_showHud;
+                break;
+            case KEY_TOGGLE_ON_DEMAND:
+                setRenderOnDemand(!m_renderOnDemand);
+                break;
+            case KEY_MINIMAP_ZOOM_IN:
+                setMinimapZoom(m_minimapZoom + 1);
+                break;
+            case KEY_MINIMAP_ZOOM_OUT:
+                setMinimapZoom(m_minimapZoom - 1);
+                break;
+            case KEY_NEXT_VIEW_RENDERER:
+                setViewRenderer((ViewRenderer)((m_viewRenderer + 1) % VIEW_RENDERER_COUNT));
+                break;
+            case KEY_RESTART_RUN:
+                restartRun();
+                break;
             default:
                 break;
         }
     }
-    keyStates[key] = state == KEY_STATE_PRESSED;
+    keys.set(key, state == KEY_STATE_PRESSED);
 }
 
 void Game::processMouseInput(double xPos, double yPos)
 {
+    TRACE_ZONE("mouse input");
     if (firstMouse)
     {
         lastX = xPos;
@@ -218,5 +785,31 @@ void Game::processMouseInput(double xPos, double yPos)
     lastX = xPos;
     lastY = yPos;
 
-    m_maze->player.processRotation(xoffset * 3, yoffset);
-}
\ No newline at end of file
+    m_mouseOffset += glm::vec2(xoffset, yoffset);
+}
+
+// Splits the viewport between the players, in two rows for two and in a two by two grid for more
+static void splitViewport(const GLint *viewport, int count, int index, int *rect)
+{
+    int columns = count > 2 ? 2 : 1;
+    int rows = count > 1 ? 2 : 1;
+    int column = index % columns, row = index / columns;
+    int width = viewport[2] / columns, height = viewport[3] / rows;
+    // the first player is at the top, where GL starts counting from the bottom
+    rect[0] = viewport[0] + column * width;
+    rect[1] = viewport[1] + (rows - 1 - row) * height;
+    rect[2] = width;
+    rect[3] = height;
+}
+
+// Whether there is no wall between the cell and its neighbour in the given direction
+static bool isPassable(int x, int y, int dx, int dy)
+{
+    if (x + dx < 0 || x + dx >= MAZE_WIDTH || y + dy < 0 || y + dy >= MAZE_HEIGHT) {
+        return false;
+    }
+    if (dx != 0) {
+        return !walls[y * 2][MAX(x, x + dx)];
+    }
+    return !walls[MIN(y, y + dy) * 2 + 1][x];
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ghostrenderer.h"
+#include "shader.h"
+#include "glstate.h"
+#include "console.h"
+#include "trace.h"
+#include "common.h"
+
+#include <GL/glew.h>
+
+// the texture unit of the samples, past those the maze and the minimap use
+#define GHOST_SAMPLES_UNIT 7
+// how far below the eye the marker floats, so that it does not hide the view of a player standing in it
+#define GHOST_DROP 0.25f
+// pixels across a ghost on the minimap, smaller than the players
+#define GHOST_DOT_SIZE 4.0f
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+// The pose of the ghost of the instance at the tick, blended from the samples on either side of it
+#define GHOST_POSE_SOURCE \
+            "layout (location = 1) in ivec2 Range;\n" \
+            "uniform sampler2D samples;\n" \
+            "uniform float tick;\n" \
+            "vec4 sampleAt(int index)\n" \
+            "{\n" \
+            "  int width = textureSize(samples, 0).x;\n" \
+            "  return texelFetch(samples, ivec2(index % width, index / width), 0);\n" \
+            "}\n" \
+            /* false once the run is over, the yaw takes the short way round */ \
+            "bool ghostPose(out vec4 pose)\n" \
+            "{\n" \
+            "  if (tick > float(Range.y - 1)) {\n" \
+            "    return false;\n" \
+            "  }\n" \
+            "  float t = max(tick, 0.0);\n" \
+            "  int i = int(t);\n" \
+            "  vec4 a = sampleAt(Range.x + i);\n" \
+            "  vec4 b = sampleAt(Range.x + min(i + 1, Range.y - 1));\n" \
+            "  float turn = mod(b.w - a.w + 3.14159265, 6.28318531) - 3.14159265;\n" \
+            "  pose = vec4(mix(a.xyz, b.xyz, t - float(i)), a.w + turn * (t - float(i)));\n" \
+            "  return true;\n" \
+            "}\n"
+
+static Shader ghostShader;
+static Shader ghostMapShader;
+
+// A diamond with its long end pointing where the ghost looks, along x
+static const float nose = 0.3f, tail = 0.15f, halfWidth = 0.15f, halfHeight = 0.2f;
+static const glm::vec3 ring[4] = {
+    glm::vec3(nose, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, halfWidth), glm::vec3(-tail, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -halfWidth)
+};
+
+GhostRenderer::GhostRenderer()
+    : m_texture(0), m_VAO(0), m_VBO(0), m_instanceBuffer(0), m_count(0)
+{
+    if (ghostShader.id() == (GLuint)-1) {
+        const char *vertexShaderSource = "#version 330 core\n"
+            "layout (location = 0) in vec3 aPos;\n"
+            GHOST_POSE_SOURCE
+            "uniform mat4 viewProjection;\n"
+            "out vec3 WorldPos;\n"
+            "flat out vec3 Color;\n"
+            "void main()\n"
+            "{\n"
+            "  vec4 pose;\n"
+            "  if (!ghostPose(pose)) {\n"
+            "    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+            "    return;\n"
+            "  }\n"
+            "  float c = cos(pose.w), s = sin(pose.w);\n"
+            "  WorldPos = pose.xyz + vec3(aPos.x * c - aPos.z * s, aPos.y - " TO_STRING(GHOST_DROP) ", aPos.x * s + aPos.z * c);\n"
+            // hues spread out by the golden ratio, so that the ghosts next to each other tell apart
+            "  float hue = fract(float(gl_InstanceID) * 0.618034);\n"
+            "  Color = 0.5 + 0.5 * cos(6.28318531 * (hue + vec3(0.0, 0.33, 0.67)));\n"
+            "  gl_Position = viewProjection * vec4(WorldPos, 1.0);\n"
+            "}\0";
+        // flat shaded from the slope of the face, the light coming from above
+        const char *fragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec3 WorldPos;\n"
+            "flat in vec3 Color;\n"
+            "void main()\n"
+            "{\n"
+            "  vec3 normal = normalize(cross(dFdx(WorldPos), dFdy(WorldPos)));\n"
+            "  FragColor = vec4(Color * (0.5 + 0.5 * abs(normal.y)), 0.6);\n"
+            "}\0";
+        ghostShader.compile(vertexShaderSource, fragmentShaderSource);
+        ghostShader.use();
+        ghostShader.setInteger("samples", GHOST_SAMPLES_UNIT);
+
+        const char *mapVertexShaderSource = "#version 330 core\n"
+            GHOST_POSE_SOURCE
+            "uniform vec2 origin;\n"
+            "uniform float scale;\n"
+            "const vec2 mazeSize = vec2(" TO_STRING(MAZE_WIDTH) ", " TO_STRING(MAZE_HEIGHT) ") * (" TO_STRING(WALL_SIZE + WALL_THICKNESS) ") - " TO_STRING(WALL_THICKNESS) ";\n"
+            "void main()\n"
+            "{\n"
+            "  gl_PointSize = " TO_STRING(GHOST_DOT_SIZE) ";\n"
+            "  vec4 pose;\n"
+            "  vec2 shown = vec2(-1.0);\n"
+            "  if (ghostPose(pose)) {\n"
+            "    shown = (pose.xz / mazeSize - origin) * scale;\n"
+            "  }\n"
+            // out of the window, a point whose center is off the screen is clipped altogether
+            "  if (any(lessThan(shown, vec2(0.0))) || any(greaterThan(shown, vec2(1.0)))) {\n"
+            "    gl_Position = vec4(-2.0, -2.0, 0.0, 1.0);\n"
+            "    return;\n"
+            "  }\n"
+            "  gl_Position = vec4(shown.x * " TO_STRING(MINIMAP_WIDTH) " + " TO_STRING(MINIMAP_X) ", -(shown.y * " TO_STRING(MINIMAP_HEIGHT) " - " TO_STRING(MINIMAP_Y) "), 0.0, 1.0);\n"
+            "}\0";
+        const char *mapFragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "void main()\n"
+            "{\n"
+            "  FragColor = vec4(0.8, 0.8, 1.0, 0.5);\n"
+            "}\0";
+        ghostMapShader.compile(mapVertexShaderSource, mapFragmentShaderSource);
+        ghostMapShader.use();
+        ghostMapShader.setInteger("samples", GHOST_SAMPLES_UNIT);
+    }
+
+    // eight faces, the upper four wound counter-clockwise seen from above and the lower four from below
+    std::vector<glm::vec3> vertices;
+    for (int i = 0; i < 4; ++i) {
+        const glm::vec3 &current = ring[i], &next = ring[(i + 1) % 4];
+        vertices.push_back(glm::vec3(0.0f, halfHeight, 0.0f));
+        vertices.push_back(next);
+        vertices.push_back(current);
+        vertices.push_back(glm::vec3(0.0f, -halfHeight, 0.0f));
+        vertices.push_back(current);
+        vertices.push_back(next);
+    }
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_VBO);
+    glGenBuffers(1, &m_instanceBuffer);
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glVertexAttribIPointer(1, 2, GL_INT, 2 * sizeof(GLint), (void*)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    CONSOLE_DEBUG("GhostRenderer [%p] created.", this);
+}
+
+GhostRenderer::~GhostRenderer()
+{
+    glDeleteTextures(1, &m_texture);
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_VBO);
+    glDeleteBuffers(1, &m_instanceBuffer);
+    CONSOLE_DEBUG("GhostRenderer [%p] destroyed.", this);
+}
+
+void GhostRenderer::setGhosts(const std::shared_ptr<const std::vector<Trajectory> > &ghosts)
+{
+    if (ghosts == m_ghosts) {
+        return;
+    }
+    TRACE_ZONE("upload ghosts");
+    m_ghosts = ghosts;
+    m_count = 0;
+    if (!ghosts || ghosts->empty()) {
+        return;
+    }
+
+    // the ghosts that do not fit into the largest texture are left out
+    GLint maxSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    const size_t maxSamples = (size_t)GHOST_TEXTURE_WIDTH * maxSize;
+    std::vector<glm::vec4> samples;
+    std::vector<GLint> ranges;
+    for (std::vector<Trajectory>::const_iterator it = ghosts->cbegin(); it != ghosts->cend(); ++it) {
+        if (it->size() == 0) {
+            continue;
+        }
+        if (samples.size() + it->size() > maxSamples) {
+            CONSOLE_WARNING("Only %d of the %d ghosts fit into the trajectory texture", m_count, (int)ghosts->size());
+            break;
+        }
+        ranges.push_back(samples.size());
+        ranges.push_back(it->size());
+        it->decode(&samples);
+        ++m_count;
+    }
+    if (m_count == 0) {
+        return;
+    }
+
+    int rows = (samples.size() + GHOST_TEXTURE_WIDTH - 1) / GHOST_TEXTURE_WIDTH;
+    samples.resize((size_t)rows * GHOST_TEXTURE_WIDTH);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, GHOST_TEXTURE_WIDTH, rows, 0, GL_RGBA, GL_FLOAT, &samples[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, ranges.size() * sizeof(GLint), &ranges[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int GhostRenderer::ghostCount() const
+{
+    return m_count;
+}
+
+void GhostRenderer::draw(const std::vector<Maze::View> &views, float tick)
+{
+    if (m_count == 0) {
+        return;
+    }
+    TRACE_ZONE("draw ghosts");
+    int viewCount = MIN((int)views.size(), MAX_PLAYERS);
+    ghostShader.use();
+    ghostShader.setFloat("tick", tick);
+    glActiveTexture(GL_TEXTURE0 + GHOST_SAMPLES_UNIT);
+    gl::bindTexture(GL_TEXTURE_2D, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindVertexArray(m_VAO);
+    // see through, behind the walls but without hiding each other
+    gl::enable(GL_BLEND);
+    gl::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl::depthMask(GL_FALSE);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for (int i = 0; i < viewCount; ++i) {
+        const Maze::View &view = views[i];
+        ghostShader.setMatrix4("viewProjection", Maze::perspective((float)view.viewport[2] / MAX(view.viewport[3], 1)) * view.view);
+        glViewport(view.viewport[0], view.viewport[1], view.viewport[2], view.viewport[3]);
+        gl::drawArraysInstanced(GL_TRIANGLES, 0, 24, m_count);
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl::depthMask(GL_TRUE);
+    gl::disable(GL_BLEND);
+    gl::bindVertexArray(0);
+}
+
+void GhostRenderer::drawMinimap(const glm::vec2 &origin, float scale, float tick)
+{
+    if (m_count == 0) {
+        return;
+    }
+    TRACE_ZONE("draw minimap ghosts");
+    ghostMapShader.use();
+    ghostMapShader.setFloat("tick", tick);
+    ghostMapShader.setVector2f("origin", origin);
+    ghostMapShader.setFloat("scale", scale);
+    glActiveTexture(GL_TEXTURE0 + GHOST_SAMPLES_UNIT);
+    gl::bindTexture(GL_TEXTURE_2D, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindVertexArray(m_VAO);
+    gl::disable(GL_DEPTH_TEST);
+    gl::enable(GL_BLEND);
+    gl::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // the size comes from the shader here, the minimap keeps the one it set for its players
+    gl::enable(GL_PROGRAM_POINT_SIZE);
+    gl::drawArraysInstanced(GL_POINTS, 0, 1, m_count);
+    gl::disable(GL_PROGRAM_POINT_SIZE);
+    gl::disable(GL_BLEND);
+    gl::enable(GL_DEPTH_TEST);
+    gl::bindVertexArray(0);
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "headless.h"
+#include "game.h"
+#include "console.h"
+#include "trace.h"
+#include "loader.h"
+#include "framecapture.h"
+#include "common.h"
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// the simulation advances at a fixed rate, so that every run sees the same frames
+#define SIMULATION_RATE 60.0f
+// the player looks at the point of the path that far ahead, which rounds off the turns
+#define LOOK_AHEAD 0.5f
+
+static glm::vec3 pathPoint(const std::vector<glm::vec3> &path, float t);
+static double percentile(const std::vector<double> &sortedTimes, double fraction);
+static unsigned long long hashPixels(const std::vector<unsigned char> &pixels);
+static void recordGhosts(Game *game, const std::vector<glm::vec3> &path, const HeadlessOptions &options);
+
+bool parseHeadlessOptions(int argc, char **argv, HeadlessOptions *options)
+{
+    options->width = SCR_WIDTH;
+    options->height = SCR_HEIGHT;
+    options->frames = 600;
+    options->warmupFrames = 10;
+    options->seed = 1;
+    options->cellsPerSecond = 2.0f;
+    options->hashInterval = 0;
+    options->players = 1;
+    options->minimapBitmask = false;
+    options->minimapZoom = 0;
+    options->viewRenderer = Game::VIEW_RASTER;
+    options->dumpPath = NULL;
+    options->capturePattern = NULL;
+    options->ghosts = 0;
+
+    bool headless = false;
+    // the options of a windowed run go through here as well, so they are only reported for a headless one
+    std::vector<const char*> unknown;
+    for (int i = 1; i < argc; ++i) {
+        const char *value = i + 1 < argc ? argv[i + 1] : "0";
+        if (!strcmp(argv[i], "--headless")) {
+            headless = true;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--minimap-bitmask")) {
+            options->minimapBitmask = true;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--raymarch")) {
+            options->viewRenderer = Game::VIEW_RAYMARCH;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--software")) {
+            options->viewRenderer = Game::VIEW_SOFTWARE;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--width")) {
+            options->width = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--height")) {
+            options->height = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--frames")) {
+            options->frames = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--warmup")) {
+            options->warmupFrames = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--seed")) {
+            options->seed = strtoul(value, NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--speed")) {
+            options->cellsPerSecond = atof(value);
+        }
+        else if (!strcmp(argv[i], "--hash-interval")) {
+            options->hashInterval = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--minimap-zoom")) {
+            options->minimapZoom = atoi(value);
+        }
+        else if (!strcmp(argv[i], "--dump")) {
+            options->dumpPath = i + 1 < argc ? argv[i + 1] : NULL;
+        }
+        else if (!strcmp(argv[i], "--capture")) {
+            options->capturePattern = i + 1 < argc ? argv[i + 1] : NULL;
+        }
+        else if (!strcmp(argv[i], "--ghosts")) {
+            options->ghosts = MAX(atoi(value), 0);
+        }
+        else if (!strcmp(argv[i], "--players")) {
+            options->players = MIN(MAX(atoi(value), 1), MAX_PLAYERS);
+        }
+        else {
+            unknown.push_back(argv[i]);
+            continue;
+        }
+        ++i;
+    }
+    if (headless) {
+        for (std::vector<const char*>::const_iterator it = unknown.cbegin(); it != unknown.cend(); ++it) {
+            std::cerr << "Unknown option " << *it << std::endl;
+        }
+    }
+    return headless;
+}
+
+int runHeadless(const HeadlessOptions &options)
+{
+    if (options.width <= 0 || options.height <= 0 || options.frames <= 0) {
+        std::cerr << "The resolution and the frame count must be positive" << std::endl;
+        return -1;
+    }
+    if (options.capturePattern && !FrameCapture::isValidPattern(options.capturePattern)) {
+        std::cerr << "The capture pattern must take the frame number through a single integer conversion, e.g. frame_%05d.png" << std::endl;
+        return -1;
+    }
+
+    // surfaceless Mesa needs neither a display server nor a window, only a render node or llvmpipe
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) : EGL_NO_DISPLAY;
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "Failed to initialize EGL" << std::endl;
+        return -1;
+    }
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cerr << "Failed to create a surfaceless OpenGL 3.3 context" << std::endl;
+        eglTerminate(display);
+        return -1;
+    }
+
+    // a GLX build of GLEW loads the entry points and only then fails to find an X display
+    glewExperimental = GL_TRUE;
+    GLenum status = glewInit();
+    if (status != GLEW_OK && status != GLEW_ERROR_NO_GLX_DISPLAY) {
+        std::cerr << "Failed to initialize GLEW: " << glewGetErrorString(status) << std::endl;
+        eglTerminate(display);
+        return -1;
+    }
+    glGetError();
+
+    unsigned int framebuffer, renderbuffers[2];
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, options.width, options.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, options.width, options.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Failed to create a " << options.width << "x" << options.height << " framebuffer" << std::endl;
+        eglTerminate(display);
+        return -1;
+    }
+    glViewport(0, 0, options.width, options.height);
+
+    // meshes and textures are uploaded through a second context sharing the objects of the first
+    EGLContext loaderContext = eglCreateContext(display, EGL_NO_CONFIG_KHR, context, contextAttributes);
+    if (loaderContext != EGL_NO_CONTEXT) {
+        ResourceLoader::Instance()->start(
+            [display, loaderContext]() { eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, loaderContext); },
+            [display]() { eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT); });
+    }
+    else {
+        std::cerr << "Failed to create a shared context, loading on the render thread" << std::endl;
+    }
+
+    Game *game = Game::Instance();
+    game->setPlayerCount(options.players);
+    game->setMinimapBitmask(options.minimapBitmask);
+    game->setMinimapZoom(options.minimapZoom);
+    game->setViewRenderer(options.viewRenderer);
+    game->restart(options.seed);
+    // the lightmap is baked in the background, waiting for it keeps the images reproducible
+    game->finishBackgroundWork();
+    std::vector<glm::vec3> path = game->tourPath();
+    recordGhosts(game, path, options);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    std::vector<double> times;
+    std::vector<std::pair<int, unsigned long long> > hashes;
+    std::vector<unsigned char> pixels;
+    FrameCapture *capture = options.capturePattern ? new FrameCapture(options.capturePattern) : NULL;
+    float yaws[MAX_PLAYERS] = { 0.0f };
+    // CPU time of the whole process over the measured frames, loader and capture threads included
+    clock_t cpuStart = 0;
+    std::chrono::steady_clock::time_point wallStart;
+    for (int frame = -options.warmupFrames; frame < options.frames; ++frame) {
+        TRACE_ZONE("frame");
+        if (frame == 0) {
+            cpuStart = clock();
+            wallStart = std::chrono::steady_clock::now();
+        }
+        for (int player = 0; player < options.players; ++player) {
+            float t = MAX(frame, 0) * options.cellsPerSecond / SIMULATION_RATE + (float)player * path.size() / options.players;
+            glm::vec3 position = pathPoint(path, t);
+            glm::vec3 direction = pathPoint(path, t + LOOK_AHEAD) - position;
+            // turning around at a dead end makes the look ahead point meet the player, keep the last yaw then
+            if (glm::dot(direction, direction) > 1e-6f) {
+                yaws[player] = glm::degrees(std::atan2(direction.z, direction.x));
+            }
+            game->placePlayer(position, yaws[player], 0.0f, player);
+        }
+        // the ghosts only move on with the simulation ticks
+        if (options.ghosts > 0) {
+            game->update(1.0 / SIMULATION_RATE);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        game->draw();
+        // the capture is part of the measured time, so a run with and without it tells what it costs
+        if (capture && frame >= 0) {
+            capture->capture(options.width, options.height);
+        }
+        glFinish();
+        if (frame >= 0) {
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        if (frame >= 0 && options.hashInterval > 0 && (frame + 1) % options.hashInterval == 0) {
+            pixels.resize(options.width * options.height * 4);
+            glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+            hashes.push_back(std::make_pair(frame, hashPixels(pixels)));
+        }
+    }
+    if (options.dumpPath) {
+        pixels.resize(options.width * options.height * 4);
+        glReadPixels(0, 0, options.width, options.height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        FILE *file = fopen(options.dumpPath, "wb");
+        if (file) {
+            FrameCapture::writePpm(file, pixels, options.width, options.height);
+            fclose(file);
+        }
+        else {
+            std::cerr << "Failed to open " << options.dumpPath << std::endl;
+        }
+    }
+    int capturedFrames = 0;
+    if (capture) {
+        capturedFrames = capture->capturedFrames();
+        delete capture;
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    // 100% is one core kept busy
+    double cpuPercent = 100.0 * (clock() - cpuStart) / CLOCKS_PER_SEC / MAX(wallSeconds, 1e-6);
+    GLenum error = glGetError();
+
+    double total = 0.0;
+    for (std::vector<double>::const_iterator it = times.cbegin(); it != times.cend(); ++it) {
+        total += *it;
+    }
+    std::sort(times.begin(), times.end());
+
+    static const char *viewRendererNames[Game::VIEW_RENDERER_COUNT] = { "raster", "raymarch", "software" };
+    printf("{\n");
+    printf("  \"renderer\": \"%s\",\n", (const char *)glGetString(GL_RENDERER));
+    printf("  \"width\": %d,\n  \"height\": %d,\n", options.width, options.height);
+    printf("  \"maze\": [%d, %d],\n", MAZE_WIDTH, MAZE_HEIGHT);
+    printf("  \"seed\": %u,\n  \"frames\": %d,\n  \"players\": %d,\n  \"minimap\": \"%s\",\n  \"view\": \"%s\",\n", options.seed, options.frames, options.players,
+           options.minimapBitmask ? "bitmask" : "lines", viewRendererNames[options.viewRenderer]);
+    printf("  \"frameTimeMs\": { \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+           total / times.size(), percentile(times, 0.50), percentile(times, 0.95), percentile(times, 0.99), times.back());
+    printf("  \"hashes\": [");
+    for (std::vector<std::pair<int, unsigned long long> >::size_type i = 0; i < hashes.size(); ++i) {
+        printf("%s{ \"frame\": %d, \"fnv1a\": \"%016llx\" }", i ? ", " : "", hashes[i].first, hashes[i].second);
+    }
+    printf("],\n");
+    printf("  \"ghosts\": %d,\n", options.ghosts);
+    printf("  \"capturedFrames\": %d,\n", capturedFrames);
+    printf("  \"processCpuPercent\": %.1f,\n", cpuPercent);
+    printf("  \"glError\": %u\n", error);
+    printf("}\n");
+
+    ResourceLoader::Instance()->stop();
+    TRACE_DUMP("trace.json");
+    glDeleteRenderbuffers(2, renderbuffers);
+    glDeleteFramebuffers(1, &framebuffer);
+    // the loader has released its context by now, so both can go along with the display
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (loaderContext != EGL_NO_CONTEXT) {
+        eglDestroyContext(display, loaderContext);
+    }
+    eglDestroyContext(display, context);
+    eglTerminate(display);
+    return error == GL_NO_ERROR ? 0 : -1;
+}
+
+// The point t cells along the path, wrapping around once the tour is done
+static glm::vec3 pathPoint(const std::vector<glm::vec3> &path, float t)
+{
+    if (path.size() < 2) {
+        return path.empty() ? glm::vec3(WALL_SIZE / 2.0f) : path[0];
+    }
+    t = std::fmod(t, (float)(path.size() - 1));
+    int segment = (int)t;
+    return glm::mix(path[segment], path[segment + 1], t - segment);
+}
+
+// Records runs along the tour for the whole benchmark, one sample per tick, each one starting further
+// along it and a little faster than the one before
+static void recordGhosts(Game *game, const std::vector<glm::vec3> &path, const HeadlessOptions &options)
+{
+    int ticks = (options.warmupFrames + options.frames) * TICK_RATE / SIMULATION_RATE + 1;
+    for (int ghost = 0; ghost < options.ghosts; ++ghost) {
+        float start = (float)ghost * path.size() / options.ghosts;
+        float speed = options.cellsPerSecond * (0.75f + 0.5f * ghost / options.ghosts);
+        Trajectory trajectory;
+        float yaw = 0.0f;
+        for (int tick = 0; tick < ticks; ++tick) {
+            float t = start + tick * speed / TICK_RATE;
+            glm::vec3 position = pathPoint(path, t);
+            glm::vec3 direction = pathPoint(path, t + LOOK_AHEAD) - position;
+            if (glm::dot(direction, direction) > 1e-6f) {
+                yaw = glm::degrees(std::atan2(direction.z, direction.x));
+            }
+            PlayerPose pose = { position, yaw, 0.0f };
+            trajectory.record(pose);
+        }
+        game->addGhost(trajectory);
+    }
+}
+
+// Nearest rank percentile of the already sorted frame times
+static double percentile(const std::vector<double> &sortedTimes, double fraction)
+{
+    int rank = (int)std::ceil(fraction * sortedTimes.size()) - 1;
+    return sortedTimes[MIN(MAX(rank, 0), (int)sortedTimes.size() - 1)];
+}
+
+static unsigned long long hashPixels(const std::vector<unsigned char> &pixels)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (std::vector<unsigned char>::const_iterator it = pixels.cbegin(); it != pixels.cend(); ++it) {
+        hash = (hash ^ *it) * 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hud.h"
+#include "shader.h"
+#include "console.h"
+#include "common.h"
+#include "glstate.h"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <ctype.h>
+#include <string.h>
+
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+// every glyph sits in a cell one pixel larger on each side, which spaces the characters and the lines
+#define GLYPH_CELL_WIDTH (GLYPH_WIDTH + 1)
+#define GLYPH_CELL_HEIGHT (GLYPH_HEIGHT + 1)
+// screen pixels per font pixel
+#define GLYPH_SCALE 2
+
+struct VertexDataHud
+{
+    glm::vec2 position;
+    glm::vec2 texCoords;
+};
+
+// Rows of the glyphs from top to bottom, the most significant of the five bits is the leftmost pixel
+static const char glyphCharacters[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:/%-()=,";
+static const unsigned char glyphRows[][GLYPH_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // space
+    { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, // 0
+    { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e }, // 1
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, // 2
+    { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e }, // 3
+    { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, // 4
+    { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e }, // 5
+    { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, // 6
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+    { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, // 8
+    { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c }, // 9
+    { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // A
+    { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e }, // B
+    { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e }, // C
+    { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c }, // D
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f }, // E
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 }, // F
+    { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f }, // G
+    { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // H
+    { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e }, // I
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c }, // J
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f }, // L
+    { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+    { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // O
+    { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 }, // P
+    { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d }, // Q
+    { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 }, // R
+    { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e }, // S
+    { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, // U
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 }, // V
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a }, // W
+    { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 }, // X
+    { 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04 }, // Y
+    { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f }, // Z
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c }, // .
+    { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 }, // :
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+    { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 }, // -
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+    { 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 }, // =
+    { 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 }, // ,
+};
+#define GLYPH_COUNT ((int)(sizeof(glyphRows) / sizeof(glyphRows[0])))
+
+static Shader hudShader;
+
+Hud::Hud()
+    : capacity(0)
+{
+    if (hudShader.id() == (GLuint)-1) {
+        const char *vertexShaderSource = "#version 330 core\n"
+            "layout (location = 0) in vec2 aPos;\n"
+            "layout (location = 1) in vec2 aTexCoord;\n"
+            "out vec2 TexCoord;\n"
+            "void main()\n"
+            "{\n"
+            "  TexCoord = aTexCoord;\n"
+            "  gl_Position = vec4(aPos, 0.0, 1.0);\n"
+            "}\0";
+        const char *fragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 TexCoord;\n"
+            "uniform sampler2D font;\n"
+            "void main()\n"
+            "{\n"
+            "  FragColor = mix(vec4(0.0, 0.0, 0.0, 0.6), vec4(1.0, 1.0, 0.6, 1.0), texture(font, TexCoord).r);\n"
+            "}\0";
+        hudShader.compile(vertexShaderSource, fragmentShaderSource);
+        hudShader.setInteger("font", 0, GL_TRUE);
+    }
+
+    // all the glyphs side by side in a single row
+    std::vector<unsigned char> pixels(GLYPH_COUNT * GLYPH_CELL_WIDTH * GLYPH_CELL_HEIGHT, 0);
+    for (int glyph = 0; glyph < GLYPH_COUNT; ++glyph) {
+        for (int row = 0; row < GLYPH_HEIGHT; ++row) {
+            for (int column = 0; column < GLYPH_WIDTH; ++column) {
+                if (glyphRows[glyph][row] & (1 << (GLYPH_WIDTH - 1 - column))) {
+                    pixels[(row + 1) * GLYPH_COUNT * GLYPH_CELL_WIDTH + glyph * GLYPH_CELL_WIDTH + column + 1] = 255;
+                }
+            }
+        }
+    }
+    glGenTextures(1, &fontTexture);
+    glBindTexture(GL_TEXTURE_2D, fontTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, GLYPH_COUNT * GLYPH_CELL_WIDTH, GLYPH_CELL_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataHud), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexDataHud), (void*)(sizeof(glm::vec2)));
+    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    CONSOLE_DEBUG("Hud [%p] created.", this);
+}
+
+Hud::~Hud()
+{
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteTextures(1, &fontTexture);
+
+    CONSOLE_DEBUG("Hud [%p] destroyed.", this);
+}
+
+float Hud::width(const std::vector<std::string> &lines) const
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    std::string::size_type longest = 0;
+    for (std::vector<std::string>::const_iterator it = lines.cbegin(); it != lines.cend(); ++it) {
+        longest = MAX(longest, it->size());
+    }
+    return longest * 2.0f * GLYPH_CELL_WIDTH * GLYPH_SCALE / viewport[2];
+}
+
+void Hud::draw(const std::vector<std::string> &lines, float x, float y)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const float cellWidth = 2.0f * GLYPH_CELL_WIDTH * GLYPH_SCALE / viewport[2];
+    const float cellHeight = 2.0f * GLYPH_CELL_HEIGHT * GLYPH_SCALE / viewport[3];
+
+    std::vector<VertexDataHud> vertices;
+    for (std::vector<std::string>::size_type line = 0; line < lines.size(); ++line) {
+        for (std::string::size_type i = 0; i < lines[line].size(); ++i) {
+            const char *found = strchr(glyphCharacters, toupper(lines[line][i]));
+            int glyph = found && *found ? found - glyphCharacters : 0;
+            float left = x + i * cellWidth, top = y - line * cellHeight;
+            float u0 = (float)glyph / GLYPH_COUNT, u1 = (float)(glyph + 1) / GLYPH_COUNT;
+            const VertexDataHud quad[6] = {
+                { { left, top }, { u0, 0.0f } },
+                { { left, top - cellHeight }, { u0, 1.0f } },
+                { { left + cellWidth, top }, { u1, 0.0f } },
+                { { left + cellWidth, top }, { u1, 0.0f } },
+                { { left, top - cellHeight }, { u0, 1.0f } },
+                { { left + cellWidth, top - cellHeight }, { u1, 1.0f } }
+            };
+            vertices.insert(vertices.end(), quad, quad + 6);
+        }
+    }
+    if (vertices.empty()) {
+        return;
+    }
+
+    gl::bindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (vertices.size() > capacity) {
+        capacity = vertices.size();
+        glBufferData(GL_ARRAY_BUFFER, sizeof(VertexDataHud) * capacity, NULL, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexDataHud) * vertices.size(), &vertices[0]);
+    gl::bindBuffer(GL_ARRAY_BUFFER, 0);
+
+    gl::disable(GL_DEPTH_TEST);
+    gl::enable(GL_BLEND);
+    hudShader.use();
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindTexture(GL_TEXTURE_2D, fontTexture);
+    gl::bindVertexArray(VAO);
+    gl::drawArrays(GL_TRIANGLES, 0, vertices.size());
+    gl::bindVertexArray(0);
+    gl::disable(GL_BLEND);
+    gl::enable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lightgrid.h"
+#include "console.h"
+#include "common.h"
+#include "glstate.h"
+#include "trace.h"
+
+#include <GL/glew.h>
+#include <algorithm>
+
+LightGrid::LightGrid(const bool *walls)
+    : m_walls(walls), m_dirty(true), m_staticBaked(false),
+      m_cellLights(MAZE_WIDTH * MAZE_HEIGHT), m_visited(MAZE_WIDTH * MAZE_HEIGHT, -1)
+{
+    glGenTextures(1, &m_cellTexture);
+    glBindTexture(GL_TEXTURE_2D, m_cellTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenBuffers(1, &m_indexBuffer);
+    glGenTextures(1, &m_indexTexture);
+    glGenBuffers(1, &m_lightBuffer);
+    glGenTextures(1, &m_lightTexture);
+
+    CONSOLE_DEBUG("LightGrid [%p] created.", this);
+}
+
+LightGrid::~LightGrid()
+{
+    glDeleteTextures(1, &m_cellTexture);
+    glDeleteTextures(1, &m_indexTexture);
+    glDeleteTextures(1, &m_lightTexture);
+    glDeleteBuffers(1, &m_indexBuffer);
+    glDeleteBuffers(1, &m_lightBuffer);
+
+    CONSOLE_DEBUG("LightGrid [%p] destroyed.", this);
+}
+
+int LightGrid::add(const Light &light)
+{
+    m_lights.push_back(light);
+    m_dirty = true;
+    return m_lights.size() - 1;
+}
+
+void LightGrid::move(int index, const glm::vec3 &position)
+{
+    m_lights[index].position = position;
+    m_dirty = true;
+}
+
+const std::vector<Light> &LightGrid::lights() const
+{
+    return m_lights;
+}
+
+void LightGrid::setStaticBaked(bool baked)
+{
+    if (m_staticBaked != baked) {
+        m_staticBaked = baked;
+        m_dirty = true;
+    }
+}
+
+void LightGrid::update()
+{
+    if (!m_dirty) {
+        return;
+    }
+    m_dirty = false;
+    TRACE_ZONE("bin lights");
+
+    for (std::vector<std::vector<int> >::iterator it = m_cellLights.begin(); it != m_cellLights.end(); ++it) {
+        it->clear();
+    }
+    std::fill(m_visited.begin(), m_visited.end(), -1);
+    for (std::vector<Light>::size_type i = 0; i < m_lights.size(); ++i) {
+        if (!m_staticBaked || !m_lights[i].isStatic) {
+            binLight(i);
+        }
+    }
+
+    // flatten the lists, keeping only the closest lights of the crowded cells
+    std::vector<GLuint> cells(MAZE_WIDTH * MAZE_HEIGHT * 2);
+    std::vector<GLuint> indices;
+    for (int cell = 0; cell < MAZE_WIDTH * MAZE_HEIGHT; ++cell) {
+        std::vector<int> &list = m_cellLights[cell];
+        if (list.size() > MAX_LIGHTS_PER_CELL) {
+            const glm::vec3 center((cell % MAZE_WIDTH + 0.5f) * (WALL_SIZE + WALL_THICKNESS), WALL_SIZE / 2.0f, (cell / MAZE_WIDTH + 0.5f) * (WALL_SIZE + WALL_THICKNESS));
+            std::nth_element(list.begin(), list.begin() + MAX_LIGHTS_PER_CELL, list.end(), [this, &center](int a, int b) {
+                return glm::distance(m_lights[a].position, center) < glm::distance(m_lights[b].position, center);
+            });
+            list.resize(MAX_LIGHTS_PER_CELL);
+        }
+        cells[cell * 2] = indices.size();
+        cells[cell * 2 + 1] = list.size();
+        indices.insert(indices.end(), list.cbegin(), list.cend());
+    }
+    std::vector<glm::vec4> lightData;
+    for (std::vector<Light>::const_iterator it = m_lights.cbegin(); it != m_lights.cend(); ++it) {
+        lightData.push_back(glm::vec4(it->position, it->radius));
+        lightData.push_back(glm::vec4(it->color, 0.0f));
+    }
+    // buffer textures may not be empty
+    indices.push_back(0);
+    lightData.push_back(glm::vec4(0.0f));
+
+    gl::bindTexture(GL_TEXTURE_2D, m_cellTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, MAZE_WIDTH, MAZE_HEIGHT, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, &cells[0]);
+
+    gl::bindBuffer(GL_TEXTURE_BUFFER, m_indexBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_DYNAMIC_DRAW);
+    gl::bindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_indexBuffer);
+
+    gl::bindBuffer(GL_TEXTURE_BUFFER, m_lightBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * lightData.size(), &lightData[0], GL_DYNAMIC_DRAW);
+    gl::bindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_lightBuffer);
+    gl::bindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    CONSOLE_DEBUG("LightGrid [%p] binned %lu lights into %lu cell entries.", this, m_lights.size(), indices.size() - 1);
+}
+
+void LightGrid::bind(int firstUnit)
+{
+    glActiveTexture(GL_TEXTURE0 + firstUnit);
+    gl::bindTexture(GL_TEXTURE_2D, m_cellTexture);
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+    gl::bindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+    glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+    gl::bindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+}
+
+void LightGrid::binLight(int index)
+{
+    const Light &light = m_lights[index];
+    const float cellSize = WALL_SIZE + WALL_THICKNESS;
+    int startX = MIN(MAX((int)(light.position.x / cellSize), 0), MAZE_WIDTH - 1);
+    int startY = MIN(MAX((int)(light.position.z / cellSize), 0), MAZE_HEIGHT - 1);
+
+    // flood the cells through the open walls, as long as they are within the light's radius
+    m_queue.clear();
+    m_queue.push_back(startY * MAZE_WIDTH + startX);
+    m_visited[m_queue.back()] = index;
+    for (std::vector<int>::size_type i = 0; i < m_queue.size(); ++i) {
+        int cell = m_queue[i], x = cell % MAZE_WIDTH, y = cell / MAZE_WIDTH;
+        m_cellLights[cell].push_back(index);
+
+        // walls[y * 2][x] separates the cell from its left neighbour and walls[y * 2 + 1][x] from the one below it
+        const int neighbors[4][3] = {
+            { x - 1, y, x > 0 && !m_walls[y * 2 * MAZE_WIDTH + x] },
+            { x + 1, y, x < MAZE_WIDTH - 1 && !m_walls[y * 2 * MAZE_WIDTH + x + 1] },
+            { x, y - 1, y > 0 && !m_walls[(y * 2 - 1) * MAZE_WIDTH + x] },
+            { x, y + 1, y < MAZE_HEIGHT - 1 && !m_walls[(y * 2 + 1) * MAZE_WIDTH + x] }
+        };
+        for (int n = 0; n < 4; ++n) {
+            if (!neighbors[n][2]) {
+                continue;
+            }
+            int next = neighbors[n][1] * MAZE_WIDTH + neighbors[n][0];
+            glm::vec2 closest = glm::clamp(glm::vec2(light.position.x, light.position.z),
+                                           glm::vec2(neighbors[n][0], neighbors[n][1]) * cellSize,
+                                           glm::vec2(neighbors[n][0] + 1, neighbors[n][1] + 1) * cellSize);
+            if (m_visited[next] != index && glm::distance(closest, glm::vec2(light.position.x, light.position.z)) < light.radius) {
+                m_visited[next] = index;
+                m_queue.push_back(next);
+            }
+        }
+    }
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lightmap.h"
+#include "threadpool.h"
+#include "console.h"
+#include "common.h"
+#include "trace.h"
+
+#include <GL/glew.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+
+#define LIGHTMAP_WIDTH (MAZE_WIDTH * LIGHTMAP_TEXELS_PER_CELL)
+#define LIGHTMAP_HEIGHT (MAZE_HEIGHT * LIGHTMAP_TEXELS_PER_CELL)
+// the baked light is stored halved, so that overlapping torches do not saturate right away
+#define LIGHTMAP_SCALE 2.0f
+#define AO_RAYS 16
+#define AO_DISTANCE (WALL_SIZE * 0.5f)
+// small enough not to step over a wall
+#define RAY_STEP (WALL_THICKNESS * 0.25f)
+
+// Everything the bake reads and writes. It is reference counted, because the
+// maze that started the bake may be destroyed before the workers are done with it.
+struct LightmapJob
+{
+    std::vector<bool> walls;
+    std::vector<Light> lights;
+    std::vector<std::vector<int> > cellLights;
+    std::vector<unsigned char> texels;
+    // bytes rather than bits, the rows are written concurrently
+    std::vector<unsigned char> solid;
+    std::atomic<bool> cancelled;
+    // the one of the thread pool, which does not wait for the bake to finish at exit
+    const std::atomic<bool> *poolStopping;
+    std::atomic<bool> finished;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    bool isCancelled() const
+    {
+        return cancelled || *poolStopping;
+    }
+
+    bool wall(int row, int column) const
+    {
+        return walls[row * MAZE_WIDTH + column];
+    }
+
+    // Whether a point of the floor plan is inside a wall, the posts joining the walls included
+    bool isSolid(float x, float z) const
+    {
+        const float cellSize = WALL_SIZE + WALL_THICKNESS;
+        if (x < 0.0f || z < 0.0f) {
+            return true;
+        }
+        int cellX = (int)(x / cellSize), cellY = (int)(z / cellSize);
+        if (cellX >= MAZE_WIDTH || cellY >= MAZE_HEIGHT) {
+            return true;
+        }
+
+        // the last WALL_THICKNESS of a cell belongs to the walls on its right and below it
+        bool inX = x - cellX * cellSize > WALL_SIZE, inY = z - cellY * cellSize > WALL_SIZE;
+        bool right = cellX == MAZE_WIDTH - 1 || wall(cellY * 2, cellX + 1);
+        bool below = cellY == MAZE_HEIGHT - 1 || wall(cellY * 2 + 1, cellX);
+        if (inX && inY) {
+            return right || below
+                   || cellX == MAZE_WIDTH - 1 || cellY == MAZE_HEIGHT - 1
+                   || wall(cellY * 2 + 2, cellX + 1) || wall(cellY * 2 + 1, cellX + 1);
+        }
+        return (inX && right) || (inY && below);
+    }
+
+    bool isVisible(const glm::vec2 &from, const glm::vec2 &to) const
+    {
+        glm::vec2 delta = to - from;
+        int steps = (int)(glm::length(delta) / RAY_STEP);
+        for (int i = 1; i < steps; ++i) {
+            glm::vec2 point = from + delta * ((float)i / steps);
+            if (isSolid(point.x, point.y)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void bakeRow(int row)
+    {
+        if (isCancelled()) {
+            return;
+        }
+        TRACE_ZONE("bake lightmap row");
+
+        const float cellSize = WALL_SIZE + WALL_THICKNESS;
+        const float texelSize = cellSize / LIGHTMAP_TEXELS_PER_CELL;
+        for (int column = 0; column < LIGHTMAP_WIDTH && !isCancelled(); ++column) {
+            glm::vec3 point((column + 0.5f) * texelSize, WALL_SIZE / 2.0f, (row + 0.5f) * texelSize);
+            glm::vec2 point2D(point.x, point.z);
+            unsigned char *texel = &texels[(row * LIGHTMAP_WIDTH + column) * 4];
+            if (isSolid(point.x, point.z)) {
+                solid[row * LIGHTMAP_WIDTH + column] = 1;
+                continue;
+            }
+
+            // the top down map does not know which way the surfaces face, so the light is baked without the cosine term
+            glm::vec3 light(0.0f);
+            const std::vector<int> &list = cellLights[(row / LIGHTMAP_TEXELS_PER_CELL) * MAZE_WIDTH + column / LIGHTMAP_TEXELS_PER_CELL];
+            for (std::vector<int>::const_iterator it = list.cbegin(); it != list.cend(); ++it) {
+                const Light &source = lights[*it];
+                float attenuation = 1.0f - glm::distance(source.position, point) / source.radius;
+                if (attenuation > 0.0f && isVisible(glm::vec2(source.position.x, source.position.z), point2D)) {
+                    light += attenuation * attenuation * source.color;
+                }
+            }
+
+            // ambient occlusion is the average distance the rays around the texel travel before hitting a wall
+            float openness = 0.0f;
+            for (int i = 0; i < AO_RAYS; ++i) {
+                float angle = 2.0f * (float)M_PI * (i + 0.5f) / AO_RAYS;
+                glm::vec2 direction(std::cos(angle), std::sin(angle));
+                float distance = RAY_STEP;
+                while (distance < AO_DISTANCE && !isSolid(point.x + direction.x * distance, point.z + direction.y * distance)) {
+                    distance += RAY_STEP;
+                }
+                openness += MIN(distance, AO_DISTANCE) / AO_DISTANCE;
+            }
+            openness /= AO_RAYS;
+
+            light = glm::clamp(light / LIGHTMAP_SCALE, 0.0f, 1.0f);
+            texel[0] = (unsigned char)(light.r * 255.0f + 0.5f);
+            texel[1] = (unsigned char)(light.g * 255.0f + 0.5f);
+            texel[2] = (unsigned char)(light.b * 255.0f + 0.5f);
+            texel[3] = (unsigned char)(openness * 255.0f + 0.5f);
+        }
+    }
+
+    // Gives the texels inside the walls the average of their open neighbours, so that
+    // filtering along a wall does not pull in the darkness of the posts
+    void dilate()
+    {
+        TRACE_ZONE("dilate lightmap");
+        std::vector<unsigned char> source(texels);
+        for (int row = 0; row < LIGHTMAP_HEIGHT; ++row) {
+            for (int column = 0; column < LIGHTMAP_WIDTH; ++column) {
+                if (!solid[row * LIGHTMAP_WIDTH + column]) {
+                    continue;
+                }
+                int sum[4] = { 0, 0, 0, 0 }, count = 0;
+                for (int y = MAX(row - 1, 0); y <= MIN(row + 1, LIGHTMAP_HEIGHT - 1); ++y) {
+                    for (int x = MAX(column - 1, 0); x <= MIN(column + 1, LIGHTMAP_WIDTH - 1); ++x) {
+                        if (!solid[y * LIGHTMAP_WIDTH + x]) {
+                            for (int c = 0; c < 4; ++c) {
+                                sum[c] += source[(y * LIGHTMAP_WIDTH + x) * 4 + c];
+                            }
+                            ++count;
+                        }
+                    }
+                }
+                for (int c = 0; count > 0 && c < 4; ++c) {
+                    texels[(row * LIGHTMAP_WIDTH + column) * 4 + c] = sum[c] / count;
+                }
+            }
+        }
+    }
+};
+
+LightmapBaker::LightmapBaker()
+    : m_texture(0)
+{
+    CONSOLE_DEBUG("LightmapBaker [%p] created.", this);
+}
+
+LightmapBaker::~LightmapBaker()
+{
+    if (m_job) {
+        m_job->cancelled = true;
+    }
+    if (m_texture) {
+        glDeleteTextures(1, &m_texture);
+    }
+    CONSOLE_DEBUG("LightmapBaker [%p] destroyed.", this);
+}
+
+void LightmapBaker::start(const bool *walls, const std::vector<Light> &lights)
+{
+    if (m_job) {
+        m_job->cancelled = true;
+    }
+
+    std::shared_ptr<LightmapJob> job = std::make_shared<LightmapJob>();
+    job->walls.assign(walls, walls + (MAZE_HEIGHT * 2 - 1) * MAZE_WIDTH);
+    job->cellLights.resize(MAZE_WIDTH * MAZE_HEIGHT);
+    job->texels.assign(LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT * 4, 0);
+    job->solid.assign(LIGHTMAP_WIDTH * LIGHTMAP_HEIGHT, 0);
+    job->cancelled = false;
+    job->poolStopping = &ThreadPool::Instance()->stopping();
+    job->finished = false;
+
+    // every cell keeps the static lights whose radius overlaps it, the rays decide the rest
+    const float cellSize = WALL_SIZE + WALL_THICKNESS;
+    for (std::vector<Light>::const_iterator it = lights.cbegin(); it != lights.cend(); ++it) {
+        if (!it->isStatic) {
+            continue;
+        }
+        int index = job->lights.size();
+        job->lights.push_back(*it);
+        int minX = MAX((int)std::floor((it->position.x - it->radius) / cellSize), 0);
+        int maxX = MIN((int)std::floor((it->position.x + it->radius) / cellSize), MAZE_WIDTH - 1);
+        int minY = MAX((int)std::floor((it->position.z - it->radius) / cellSize), 0);
+        int maxY = MIN((int)std::floor((it->position.z + it->radius) / cellSize), MAZE_HEIGHT - 1);
+        for (int y = minY; y <= maxY; ++y) {
+            for (int x = minX; x <= maxX; ++x) {
+                job->cellLights[y * MAZE_WIDTH + x].push_back(index);
+            }
+        }
+    }
+
+    m_job = job;
+    ThreadPool::Instance()->submit([job]() {
+        ThreadPool::Instance()->parallelFor(LIGHTMAP_HEIGHT, [&job](int row) { job->bakeRow(row); });
+        if (!job->isCancelled()) {
+            job->dilate();
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->finished = true;
+            job->done.notify_all();
+        }
+    });
+    CONSOLE_DEBUG("LightmapBaker [%p] started baking %lu static lights.", this, job->lights.size());
+}
+
+bool LightmapBaker::poll()
+{
+    if (!m_job || !m_job->finished) {
+        return m_texture != 0 && !m_job;
+    }
+
+    TRACE_ZONE("upload lightmap");
+    if (!m_texture) {
+        glGenTextures(1, &m_texture);
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, LIGHTMAP_WIDTH, LIGHTMAP_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, &m_job->texels[0]);
+    m_job.reset();
+
+    CONSOLE_DEBUG("LightmapBaker [%p] uploaded the %dx%d lightmap.", this, LIGHTMAP_WIDTH, LIGHTMAP_HEIGHT);
+    return true;
+}
+
+void LightmapBaker::wait()
+{
+    if (m_job) {
+        std::unique_lock<std::mutex> lock(m_job->mutex);
+        m_job->done.wait(lock, [this]() { return m_job->finished.load(); });
+    }
+}
+
+unsigned int LightmapBaker::texture() const
+{
+    return m_texture;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loader.h"
+#include "console.h"
+#include "trace.h"
+
+// how long wait() sleeps on a fence before checking it again, in nanoseconds
+#define FENCE_WAIT_TIMEOUT 1000000
+
+LoadTicket::LoadTicket()
+    : m_issued(false), m_fence(0)
+{
+}
+
+LoadTicket::~LoadTicket()
+{
+    // sync objects are shared, so it does not matter which of the two contexts deletes it
+    if (m_fence) {
+        glDeleteSync(m_fence);
+    }
+}
+
+bool LoadTicket::isReady()
+{
+    if (!m_issued) {
+        return false;
+    }
+    if (m_fence) {
+        GLenum status = glClientWaitSync(m_fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return false;
+        }
+        glDeleteSync(m_fence);
+        m_fence = 0;
+    }
+    return true;
+}
+
+void LoadTicket::wait()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_issued.load(); });
+    }
+    while (!isReady()) {
+        glClientWaitSync(m_fence, 0, FENCE_WAIT_TIMEOUT);
+    }
+}
+
+ResourceLoader *ResourceLoader::Instance()
+{
+    static ResourceLoader instance;
+    return &instance;
+}
+
+ResourceLoader::ResourceLoader()
+    : m_stopping(false)
+{
+    CONSOLE_DEBUG("ResourceLoader [%p] created.", this);
+}
+
+ResourceLoader::~ResourceLoader()
+{
+    stop();
+    CONSOLE_DEBUG("ResourceLoader [%p] destroyed.", this);
+}
+
+void ResourceLoader::start(const std::function<void()> &makeCurrent, const std::function<void()> &doneCurrent)
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+    m_stopping = false;
+    m_thread = std::thread(&ResourceLoader::loaderLoop, this, makeCurrent, doneCurrent);
+}
+
+void ResourceLoader::stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+std::shared_ptr<LoadTicket> ResourceLoader::submit(const std::function<void()> &job)
+{
+    std::shared_ptr<LoadTicket> ticket = std::make_shared<LoadTicket>();
+    if (!m_thread.joinable()) {
+        // commands of the same context execute in order, so there is nothing to fence
+        job();
+        ticket->m_issued = true;
+        return ticket;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back(std::make_pair(job, ticket));
+    }
+    m_condition.notify_one();
+    return ticket;
+}
+
+void ResourceLoader::loaderLoop(std::function<void()> makeCurrent, std::function<void()> doneCurrent)
+{
+    TRACE_THREAD_NAME("loader");
+    makeCurrent();
+    for (;;) {
+        std::pair<std::function<void()>, std::shared_ptr<LoadTicket> > job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping && m_jobs.empty()) {
+                break;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+
+        job.first();
+        // the flush makes sure the fence reaches the GPU, otherwise the other context could wait on it forever
+        LoadTicket &ticket = *job.second;
+        ticket.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glFlush();
+        {
+            std::lock_guard<std::mutex> lock(ticket.m_mutex);
+            ticket.m_issued = true;
+        }
+        ticket.m_condition.notify_all();
+    }
+    doneCurrent();
+}
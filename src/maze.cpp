@@ -26,21 +26,91 @@
 #include "common.h"
 #include "shader.h"
 #include "console.h"
-#include "player.h"
-
-#define STB_IMAGE_IMPLEMENTATION // nessesary to use stb_image.h
-#include "stb_image.h"
+#include "texture.h"
+#include "glstate.h"
+#include "trace.h"
+#include "loader.h"
 
 #include <GL/glew.h>
+#include <vector>
 #include <algorithm>
+#include <float.h>
+#include <stdio.h>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_access.hpp>
 
 #define TOP_LEFT_INDEX 0
 #define BOTTOM_LEFT_INDEX 1
 #define TOP_RIGHT_INDEX 2
 #define BOTTOM_RIGHT_INDEX 3
 
-#define INSERT_CLOCKWISE() do { \
+#define CHUNKS_X ((MAZE_WIDTH + MAZE_CHUNK_SIZE - 1) / MAZE_CHUNK_SIZE)
+#define CHUNKS_Y ((MAZE_HEIGHT + MAZE_CHUNK_SIZE - 1) / MAZE_CHUNK_SIZE)
+// every wall faces one of +X, -X, +Z, -Z, and each chunk keeps its faces bucketed by that direction
+#define CHUNK_DIRECTIONS 4
+// number of wall runs closest to the player that are rasterized into the occlusion buffer each frame
+#define MAX_OCCLUDERS 48
+#define VIEW_MASKS (1 << MAX_PLAYERS)
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
+
+// The lighting shared by the rasterized and the ray marched maze. A point of a face is lit by the
+// player, the lightmap or the ambient term and the lights binned into its cell of the light grid.
+#define SHADING_SOURCE \
+            "uniform sampler2DArray texture_D;\n" \
+            "uniform sampler2DArray texture_N;\n" \
+            "uniform usampler2D lightCells;\n" \
+            "uniform usamplerBuffer lightIndices;\n" \
+            "uniform samplerBuffer lightData;\n" \
+            "uniform float cellSize;\n" \
+            "uniform sampler2D lightmap;\n" \
+            "uniform bool useLightmap;\n" \
+            /* sums the lights binned into the cell of the point, pushed off the face it lies on */ \
+            "vec3 cellLighting(vec3 fragPos, vec3 faceNormal, vec3 norm)\n" \
+            "{\n" \
+            "  ivec2 cell = clamp(ivec2((fragPos.xz + faceNormal.xz * 0.01) / cellSize), ivec2(0), textureSize(lightCells, 0) - 1);\n" \
+            "  uvec2 range = texelFetch(lightCells, cell, 0).rg;\n" \
+            "  vec3 lighting = vec3(0.0);\n" \
+            "  for (uint i = 0u; i < range.y; ++i) {\n" \
+            "    int light = int(texelFetch(lightIndices, int(range.x + i)).r);\n" \
+            "    vec4 positionRadius = texelFetch(lightData, light * 2);\n" \
+            "    vec3 toLight = positionRadius.xyz - fragPos;\n" \
+            "    float attenuation = clamp(1.0 - length(toLight) / positionRadius.w, 0.0, 1.0);\n" \
+            "    lighting += max(dot(norm, normalize(toLight)), 0.0) * attenuation * attenuation * texelFetch(lightData, light * 2 + 1).rgb;\n" \
+            "  }\n" \
+            "  return lighting;\n" \
+            "}\n" \
+            /* only the red and green channels of the normal map are read, so that two channel compressed ones work as well */ \
+            "vec3 shade(vec3 fragPos, vec3 faceNormal, vec2 normalTexel, vec3 diffuseTexel, vec2 lightmapCoord, vec3 lightPosition)\n" \
+            "{\n" \
+            "  vec3 normal;\n" \
+            "  normal.xy = normalTexel * 2.0 - 1.0;\n" \
+            "  normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));\n" \
+            "  if (faceNormal.x != 0)" \
+            "    normal = normal.zyx;\n" \
+            "  else if (faceNormal.y != 0)" \
+            "    normal = normal.xzy;\n" \
+            "  vec3 norm = normal * normalize(faceNormal);\n" \
+            "  vec3 lightDir = normalize(lightPosition - fragPos);\n" \
+            "  float diff = max(dot(norm, lightDir), 0.0);\n" \
+            "  vec3 diffuse = diff * vec3(1.0);\n" \
+            /* the static lights come from the lightmap once baked, its alpha occludes the ambient term */ \
+            "  float ambient = 0.1;\n" \
+            "  vec3 baked = vec3(0.0);\n" \
+            "  if (useLightmap) {\n" \
+            "    vec4 texel = texture(lightmap, lightmapCoord);\n" \
+            "    ambient *= texel.a;\n" \
+            "    baked = texel.rgb * 2.0;\n" \
+            "  }\n" \
+            "  return (ambient + diffuse + baked + cellLighting(fragPos, faceNormal, norm)) * diffuseTexel;\n" \
+            "}\n"
+
+#define INSERT_CLOCKWISE(target) do { \
+                            std::vector<GLuint> &indices = (target); \
+                            for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) { \
+                                v[k].material = material; \
+                            } \
                             insertVertex(vertices, indices, v[TOP_LEFT_INDEX]); \
                             insertVertex(vertices, indices, v[TOP_RIGHT_INDEX] ); \
                             insertVertex(vertices, indices, v[BOTTOM_RIGHT_INDEX]); \
@@ -49,7 +119,11 @@
                             insertVertex(vertices, indices, v[TOP_LEFT_INDEX]); \
                         } while (0)
 
-#define INSERT_COUNTERCLOCKWISE() do { \
+#define INSERT_COUNTERCLOCKWISE(target) do { \
+                            std::vector<GLuint> &indices = (target); \
+                            for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) { \
+                                v[k].material = material; \
+                            } \
                             insertVertex(vertices, indices, v[BOTTOM_RIGHT_INDEX]); \
                             insertVertex(vertices, indices, v[TOP_RIGHT_INDEX] ); \
                             insertVertex(vertices, indices, v[TOP_LEFT_INDEX]); \
@@ -63,41 +137,97 @@ struct VertexData
     glm::vec3 position;
     glm::vec2 texCoords;
     glm::vec3 normal;
+    GLuint material;
+    glm::vec2 lightmapCoords;
+};
+
+struct MeshChunk
+{
+    std::vector<GLuint> indices;
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 normal;
+};
+
+// What the loader builds and uploads for a maze. It is reference counted, because the
+// maze may be destroyed while its upload is still queued.
+struct MazeMesh
+{
+    GLuint VBO;
+    GLuint EBO;
+    GLuint numPoints;
+    std::vector<Maze::DrawRange> ranges;
+    std::vector<Occluder> occluders;
 };
 
 bool operator==(const VertexData &lhs, const VertexData &rhs)
 {
-    return lhs.position == rhs.position && lhs.texCoords == rhs.texCoords && lhs.normal == rhs.normal;
+    return lhs.position == rhs.position && lhs.texCoords == rhs.texCoords && lhs.normal == rhs.normal && lhs.material == rhs.material;
 }
 
+static void loadMesh(const std::vector<bool> &walls, MazeMesh *mesh);
 static void insertVertex(std::vector<VertexData> &vertices, std::vector<GLuint> &indices, const VertexData &point);
-static unsigned int makeTexture(const char *texturePath);
+static std::vector<GLuint> &chunkIndices(std::vector<MeshChunk> &chunks, const VertexData *face);
+static bool isBoxInFrustum(const glm::vec4 *planes, const glm::vec3 &min, const glm::vec3 &max);
+static bool isRangeFacingEye(const Maze::DrawRange &range, const glm::vec3 &eye);
+static Occluder makeOccluder(const glm::vec3 &start, const glm::vec3 &end);
+static GLuint runMaterial(int x, int y, int orientation);
 static Shader mazeShader;
+static Shader raymarchShader;
+static bool hasMultiDrawIndirect;
+// whether the vertex shader can pick the viewport, so that all views are drawn as instances of one draw
+static bool hasViewportArrays;
+
+// the view indices of every view mask back to back, the instances drawn for a mask start at its first
+static std::vector<GLuint> viewIndices;
+static GLuint maskFirstInstance[VIEW_MASKS];
+static GLuint maskViewCount[VIEW_MASKS];
+
+// Diffuse and normal maps of the wall materials. Every material is a layer of the two
+// texture arrays and the vertices carry the layer they are drawn with, so any number
+// of materials is rendered with the same draw call and bindings.
+static const char *materialTextures[][2] = {
+    { "./resources/textures/wall_diffuse.jpg", "./resources/textures/wall_normal.jpg" },
+};
+#define MATERIAL_COUNT ((int)(sizeof(materialTextures) / sizeof(materialTextures[0])))
 
 static unsigned int wallTexture_D, wallTexture_N;
+static std::shared_ptr<LoadTicket> textureUpload;
 
-Maze::Maze(bool *walls)
-    : numPoints(0), player(walls)
+Maze::Maze(const bool *walls)
+    : VAO(0), indirectBuffer(0), viewIndexBuffer(0), raymarchTexture(0), raymarchVAO(0), numPoints(0), mesh(std::make_shared<MazeMesh>()), lights(walls)
 {
-    if (mazeShader.id() == -1) {
-        glm::mat4 projection = glm::mat4(1.0f);
-        projection = glm::perspective(glm::radians(60.0f), SCR_WIDTH / SCR_HEIGHT, 0.05f, (WALL_SIZE + WALL_THICKNESS) * MAX(MAZE_WIDTH, MAZE_HEIGHT));
-
+    if (mazeShader.id() == (GLuint)-1) {
+        // either extension lets the vertex shader write gl_ViewportIndex
         const char *vertexShaderSource = "#version 330 core\n"
+            "#extension GL_ARB_shader_viewport_layer_array : enable\n"
+            "#extension GL_AMD_vertex_shader_viewport_index : enable\n"
             "layout (location = 0) in vec3 aPos;\n"
             "layout (location = 1) in vec2 aTexCoord;\n"
             "layout (location = 2) in vec3 aNormal;\n"
+            "layout (location = 3) in uint aMaterial;\n"
+            "layout (location = 4) in vec2 aLightmapCoord;\n"
+            "layout (location = 5) in uint aView;\n"
             "out vec2 TexCoord;\n"
+            "out vec2 LightmapCoord;\n"
             "out vec3 Normal;\n"
             "out vec3 FragPos;\n"
-            "uniform mat4 view;\n"
-            "uniform mat4 projection;\n"
+            "flat out uint Material;\n"
+            "flat out uint View;\n"
+            "uniform mat4 views[" TO_STRING(MAX_PLAYERS) "];\n"
+            "uniform mat4 projections[" TO_STRING(MAX_PLAYERS) "];\n"
             "void main()\n"
             "{\n"
-            "  gl_Position = projection * view * vec4(aPos, 1.0);\n"
+            "  gl_Position = projections[aView] * views[aView] * vec4(aPos, 1.0);\n"
+            "#if defined(GL_ARB_shader_viewport_layer_array) || defined(GL_AMD_vertex_shader_viewport_index)\n"
+            "  gl_ViewportIndex = int(aView);\n"
+            "#endif\n"
+            "  View = aView;\n"
             "  TexCoord = vec2(aTexCoord.x, aTexCoord.y);\n"
             "  Normal = aNormal;\n"
             "  FragPos = aPos;\n"
+            "  Material = aMaterial;\n"
+            "  LightmapCoord = aLightmapCoord;\n"
             "}\0";
         const char *fragmentShaderSource = "#version 330 core\n"
             "out vec4 FragColor;\n"
@@ -105,22 +235,15 @@ Maze::Maze(bool *walls)
             "in vec2 TexCoord;\n"
             "in vec3 Normal;\n"
             "in vec3 FragPos;\n"
-            "uniform sampler2D texture_D;\n"
-            "uniform sampler2D texture_N;\n"
-            "uniform vec3 lightPos;\n"
+            "flat in uint Material;\n"
+            "flat in uint View;\n"
+            "in vec2 LightmapCoord;\n"
+            "uniform vec3 lightPositions[" TO_STRING(MAX_PLAYERS) "];\n"
+            SHADING_SOURCE
             "void main()\n"
             "{\n"
-            "  vec3 normal = texture(texture_N, TexCoord).rgb;"
-            "  normal = normalize(normal * 2.0 - 1.0);"
-            "  if (Normal.x != 0)"
-            "    normal = normal.zyx;\n"
-            "  else if (Normal.y != 0)"
-            "    normal = normal.xzy;\n"
-            "  vec3 norm = normal * normalize(Normal);\n"
-            "  vec3 lightDir = normalize(lightPos - FragPos);\n"
-            "  float diff = max(dot(norm, lightDir), 0.0);\n"
-            "  vec3 diffuse = diff * vec3(1.0);\n"
-            "  vec3 result = (0.1 + diffuse) * texture(texture_D, TexCoord).rgb;\n"
+            "  vec3 texCoord = vec3(TexCoord, Material);\n"
+            "  vec3 result = shade(FragPos, Normal, texture(texture_N, texCoord).rg, texture(texture_D, texCoord).rgb, LightmapCoord, lightPositions[View]);\n"
             "  FragColor = vec4(result, 1.0);\n"
 #else
             "void main()\n"
@@ -130,33 +253,546 @@ Maze::Maze(bool *walls)
             "}\0";
 
         mazeShader.compile(vertexShaderSource, fragmentShaderSource);
-        mazeShader.setMatrix4("projection", projection, GL_TRUE);
+        mazeShader.use();
         mazeShader.setInteger("texture_D", 0);
         mazeShader.setInteger("texture_N", 1);
+        mazeShader.setInteger("lightCells", 2);
+        mazeShader.setInteger("lightIndices", 3);
+        mazeShader.setInteger("lightData", 4);
+        mazeShader.setFloat("cellSize", WALL_SIZE + WALL_THICKNESS);
+        mazeShader.setInteger("lightmap", 5);
+
+        // one triangle covers the viewport, the rays are cast from the eye through the far plane
+        const char *raymarchVertexShaderSource = "#version 330 core\n"
+            "out vec2 Position;\n"
+            "void main()\n"
+            "{\n"
+            "  Position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;\n"
+            "  gl_Position = vec4(Position, 0.0, 1.0);\n"
+            "}\0";
+        const char *raymarchFragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 Position;\n"
+            "uniform mat4 viewProjection;\n"
+            "uniform mat4 inverseViewProjection;\n"
+            "uniform vec3 eye;\n"
+            "uniform usampler2D cells;\n"
+            SHADING_SOURCE
+            "const float pitch = " TO_STRING(WALL_SIZE + WALL_THICKNESS) ";\n"
+            "const float thickness = " TO_STRING(WALL_THICKNESS) ";\n"
+            "const float height = " TO_STRING(WALL_SIZE) ";\n"
+            "const vec2 mazeSize = vec2(" TO_STRING(MAZE_WIDTH) ", " TO_STRING(MAZE_HEIGHT) ") * pitch;\n"
+            // keeps the nearest entry into a box in front of the eye, the walls are as high as the maze
+            "void hitBox(vec2 origin, vec2 inverseDirection, vec2 low, vec2 high, uint boxMaterial, inout float t, inout vec2 normal, inout uint material)\n"
+            "{\n"
+            "  vec2 t0 = (low - origin) * inverseDirection;\n"
+            "  vec2 t1 = (high - origin) * inverseDirection;\n"
+            "  vec2 near = min(t0, t1);\n"
+            "  vec2 far = max(t0, t1);\n"
+            "  float enter = max(near.x, near.y);\n"
+            "  if (enter <= min(far.x, far.y) && enter >= 0.0 && enter < t) {\n"
+            "    t = enter;\n"
+            "    normal = near.x > near.y ? vec2(-sign(inverseDirection.x), 0.0) : vec2(0.0, -sign(inverseDirection.y));\n"
+            "    material = boxMaterial;\n"
+            "  }\n"
+            "}\n"
+            // the texture coordinates run along the inner walls like in the mesh, while the outer walls, the floor
+            // and the ceiling are stretched over a whole number of repeats. The right wall stops short of the exit.
+            "vec2 texCoordAt(vec3 position, vec3 normal)\n"
+            "{\n"
+            "  const vec2 repeats = vec2(" TO_STRING(MAZE_WIDTH) ", " TO_STRING(MAZE_HEIGHT) ");\n"
+            "  vec2 inside = mazeSize - thickness;\n"
+            "  if (normal.x != 0.0) {\n"
+            "    if (position.x < thickness)\n"
+            "      return vec2((inside.y - position.z) / inside.y * repeats.y, position.y / height);\n"
+            "    if (position.x > inside.x - thickness)\n"
+            "      return vec2((inside.y - height - position.z) / (inside.y - height) * repeats.y, position.y / height);\n"
+            "    return position.zy / height;\n"
+            "  }\n"
+            "  if (normal.z != 0.0) {\n"
+            "    if (position.z < thickness || position.z > inside.y - thickness)\n"
+            "      return vec2(position.x / inside.x * repeats.x, position.y / height);\n"
+            "    return position.xy / height;\n"
+            "  }\n"
+            "  return vec2(position.x, inside.y - position.z) / inside * repeats;\n"
+            "}\n"
+            "void main()\n"
+            "{\n"
+            "  vec4 farPoint = inverseViewProjection * vec4(Position, 1.0, 1.0);\n"
+            "  vec3 direction = normalize(farPoint.xyz / farPoint.w - eye);\n"
+            // the floor or the ceiling ends the ray unless a wall is met first
+            "  float tPlane = direction.y < 0.0 ? -eye.y / direction.y : direction.y > 0.0 ? (height - eye.y) / direction.y : 1e30;\n"
+            "  vec2 origin = eye.xz;\n"
+            "  vec2 planar = mix(direction.xz, vec2(1e-6), lessThan(abs(direction.xz), vec2(1e-6)));\n"
+            "  vec2 inverseDirection = 1.0 / planar;\n"
+            "  ivec2 stepDirection = ivec2(sign(planar));\n"
+            // walks the cells the ray crosses in order, so the first one with a hit holds the nearest
+            "  ivec2 cell = ivec2(floor((origin + thickness) / pitch));\n"
+            "  vec2 tNext = (vec2(cell + max(stepDirection, ivec2(0))) * pitch - thickness - origin) * inverseDirection;\n"
+            "  vec2 tDelta = abs(pitch * inverseDirection);\n"
+            "  float tCell = 0.0;\n"
+            "  float tWall = 1e30;\n"
+            "  vec2 wallNormal = vec2(0.0);\n"
+            "  uint material = 0u;\n"
+            "  for (int i = 0; i < " TO_STRING(RAY_CELLS_X + RAY_CELLS_Y) " && tCell < tPlane; ++i) {\n"
+            "    if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, textureSize(cells, 0))))\n"
+            "      break;\n"
+            "    uint bits = texelFetch(cells, cell, 0).r;\n"
+            "    vec2 corner = vec2(cell) * pitch - thickness;\n"
+            "    if ((bits & " TO_STRING(RAY_LEFT_WALL) ") != 0u)\n"
+            "      hitBox(origin, inverseDirection, corner + vec2(0.0, thickness), corner + vec2(thickness, pitch), (bits >> " TO_STRING(RAY_LEFT_MATERIAL_SHIFT) ") & 255u, tWall, wallNormal, material);\n"
+            "    if ((bits & " TO_STRING(RAY_TOP_WALL) ") != 0u)\n"
+            "      hitBox(origin, inverseDirection, corner + vec2(thickness, 0.0), corner + vec2(pitch, thickness), (bits >> " TO_STRING(RAY_TOP_MATERIAL_SHIFT) ") & 255u, tWall, wallNormal, material);\n"
+            "    if ((bits & " TO_STRING(RAY_CORNER) ") != 0u)\n"
+            "      hitBox(origin, inverseDirection, corner, corner + thickness, bits >> " TO_STRING(RAY_CORNER_MATERIAL_SHIFT) ", tWall, wallNormal, material);\n"
+            "    if (tWall < 1e30)\n"
+            "      break;\n"
+            "    if (tNext.x < tNext.y) {\n"
+            "      tCell = tNext.x;\n"
+            "      tNext.x += tDelta.x;\n"
+            "      cell.x += stepDirection.x;\n"
+            "    }\n"
+            "    else {\n"
+            "      tCell = tNext.y;\n"
+            "      tNext.y += tDelta.y;\n"
+            "      cell.y += stepDirection.y;\n"
+            "    }\n"
+            "  }\n"
+            "  bool wall = tWall < tPlane;\n"
+            "  float t = min(tWall, tPlane);\n"
+            "  vec3 position = eye + direction * t;\n"
+            "  vec3 normal = wall ? vec3(wallNormal.x, 0.0, wallNormal.y) : vec3(0.0, -sign(direction.y), 0.0);\n"
+            "  if (!wall) {\n"
+            "    material = 0u;\n"
+            "  }\n"
+            // the footprint of the pixel on the plane that was hit, a neighbour may have hit another one
+            "  vec3 dx = dFdx(direction), dy = dFdy(direction);\n"
+            "  float facing = dot(direction, normal);\n"
+            "  vec3 positionDx = t * (dx - direction * dot(dx, normal) / facing);\n"
+            "  vec3 positionDy = t * (dy - direction * dot(dy, normal) / facing);\n"
+            "  vec2 texCoord = texCoordAt(position, normal);\n"
+            "  vec2 texCoordDx = texCoordAt(position + positionDx, normal) - texCoord;\n"
+            "  vec2 texCoordDy = texCoordAt(position + positionDy, normal) - texCoord;\n"
+            "  vec3 layerCoord = vec3(texCoord, material);\n"
+            "  vec2 normalTexel = textureGrad(texture_N, layerCoord, texCoordDx, texCoordDy).rg;\n"
+            "  vec3 diffuseTexel = textureGrad(texture_D, layerCoord, texCoordDx, texCoordDy).rgb;\n"
+            // nothing is drawn past the far plane, nor out of the exit, where the floor ends
+            "  vec4 clip = viewProjection * vec4(position, 1.0);\n"
+            "  if (t >= 1e30 || clip.z > clip.w || (!wall && (any(lessThan(position.xz, vec2(0.0))) || any(greaterThan(position.xz, mazeSize - thickness)))))\n"
+            "    discard;\n"
+            "  vec2 lightmapCoord = (position.xz + normal.xz * (pitch / " TO_STRING(LIGHTMAP_TEXELS_PER_CELL) ")) / mazeSize;\n"
+            "  FragColor = vec4(shade(position, normal, normalTexel, diffuseTexel, lightmapCoord, eye), 1.0);\n"
+            "  gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+            "}\0";
+
+        raymarchShader.compile(raymarchVertexShaderSource, raymarchFragmentShaderSource);
+        raymarchShader.use();
+        raymarchShader.setInteger("texture_D", 0);
+        raymarchShader.setInteger("texture_N", 1);
+        raymarchShader.setInteger("lightCells", 2);
+        raymarchShader.setInteger("lightIndices", 3);
+        raymarchShader.setInteger("lightData", 4);
+        raymarchShader.setFloat("cellSize", WALL_SIZE + WALL_THICKNESS);
+        raymarchShader.setInteger("lightmap", 5);
+        raymarchShader.setInteger("cells", 6);
+
+        textureUpload = ResourceLoader::Instance()->submit([]() {
+            const char *diffusePaths[MATERIAL_COUNT], *normalPaths[MATERIAL_COUNT];
+            for (int i = 0; i < MATERIAL_COUNT; ++i) {
+                diffusePaths[i] = materialTextures[i][0];
+                normalPaths[i] = materialTextures[i][1];
+            }
+            wallTexture_D = makeTextureArray(diffusePaths, MATERIAL_COUNT);
+            wallTexture_N = makeTextureArray(normalPaths, MATERIAL_COUNT);
+        });
+
+        hasMultiDrawIndirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+        CONSOLE_INFO("Multi-draw indirect is %s", hasMultiDrawIndirect ? "supported" : "not supported");
+        hasViewportArrays = (GLEW_VERSION_4_1 || GLEW_ARB_viewport_array) &&
+                            (GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_viewport_index);
+        CONSOLE_INFO("Viewport selection in the vertex shader is %s", hasViewportArrays ? "supported" : "not supported");
+
+        for (unsigned int mask = 0; mask < VIEW_MASKS; ++mask) {
+            maskFirstInstance[mask] = viewIndices.size();
+            for (GLuint view = 0; view < MAX_PLAYERS; ++view) {
+                if (mask & (1u << view)) {
+                    viewIndices.push_back(view);
+                }
+            }
+            maskViewCount[mask] = viewIndices.size() - maskFirstInstance[mask];
+        }
+    }
+
+    // the mesh is built and uploaded by the loader, the maze is drawn once it is done
+    std::shared_ptr<MazeMesh> mesh = this->mesh;
+    std::vector<bool> wallsCopy(walls, walls + (MAZE_HEIGHT * 2 - 1) * MAZE_WIDTH);
+    meshUpload = ResourceLoader::Instance()->submit([mesh, wallsCopy]() { loadMesh(wallsCopy, mesh.get()); });
+
+    // the ray marcher needs no more than a texel per cell, which is made right away
+    std::vector<GLuint> cells = rayCells(walls);
+    glGenTextures(1, &raymarchTexture);
+    glBindTexture(GL_TEXTURE_2D, raymarchTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, RAY_CELLS_X, RAY_CELLS_Y, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &cells[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenVertexArrays(1, &raymarchVAO);
+
+    CONSOLE_DEBUG("Maze [%p] created.", this);
+}
+
+Maze::~Maze()
+{
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteBuffers(1, &viewIndexBuffer);
+    glDeleteTextures(1, &raymarchTexture);
+    glDeleteVertexArrays(1, &raymarchVAO);
+    // the upload may still be queued, so the buffers are deleted on the loader right after it
+    std::shared_ptr<MazeMesh> mesh = this->mesh;
+    ResourceLoader::Instance()->submit([mesh]() {
+        glDeleteBuffers(1, &mesh->VBO);
+        glDeleteBuffers(1, &mesh->EBO);
+    });
+
+    CONSOLE_DEBUG("Maze [%p] destroyed.", this);
+}
+
+void Maze::draw(const std::vector<View> &views)
+{
+    TRACE_ZONE("draw maze");
+    if (!isLoaded()) {
+        return;
+    }
+    int viewCount = MIN((int)views.size(), MAX_PLAYERS);
+    mazeShader.use();
+    // camera transformations, the perspective follows the shape of the part of the framebuffer the view is drawn in
+    rangeViews.assign(ranges.size(), 0);
+    char name[32];
+    for (int i = 0; i < viewCount; ++i) {
+        const View &view = views[i];
+        glm::mat4 projection = perspective((float)view.viewport[2] / MAX(view.viewport[3], 1));
+        snprintf(name, sizeof(name), "views[%d]", i);
+        mazeShader.setMatrix4(name, view.view);
+        snprintf(name, sizeof(name), "projections[%d]", i);
+        mazeShader.setMatrix4(name, projection);
+        snprintf(name, sizeof(name), "lightPositions[%d]", i);
+        mazeShader.setVector3f(name, view.eye);
+        cullRanges(i, projection * view.view, view.eye);
+    }
+    gl::bindVertexArray(VAO);
+    bool baked = bindShading();
+    mazeShader.setInteger("useLightmap", baked);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    // a single view goes without the instancing, which some drivers take a slower path for
+    bool instanced = viewIndexBuffer && viewCount > 1;
+    if (viewIndexBuffer) {
+        if (instanced) {
+            glEnableVertexAttribArray(5);
+        }
+        else {
+            glDisableVertexAttribArray(5);
+        }
+    }
+    if (instanced) {
+        for (int i = 0; i < viewCount; ++i) {
+            glViewportIndexedf(i, views[i].viewport[0], views[i].viewport[1], views[i].viewport[2], views[i].viewport[3]);
+        }
+        drawRanges((1u << viewCount) - 1);
+    }
+    else {
+        // glViewport sets every viewport, so the one the shader may pick is the right one as well
+        for (int i = 0; i < viewCount; ++i) {
+            glViewport(views[i].viewport[0], views[i].viewport[1], views[i].viewport[2], views[i].viewport[3]);
+            glVertexAttribI4ui(5, i, 0, 0, 0);
+            drawRanges(1u << i);
+        }
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl::bindVertexArray(0);
+}
+
+void Maze::drawRaymarched(const std::vector<View> &views)
+{
+    TRACE_ZONE("draw raymarched maze");
+    if (!isLoaded()) {
+        return;
+    }
+    int viewCount = MIN((int)views.size(), MAX_PLAYERS);
+    raymarchShader.use();
+    gl::bindVertexArray(raymarchVAO);
+    bool baked = bindShading();
+    raymarchShader.setInteger("useLightmap", baked);
+    glActiveTexture(GL_TEXTURE6);
+    gl::bindTexture(GL_TEXTURE_2D, raymarchTexture);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    for (int i = 0; i < viewCount; ++i) {
+        const View &view = views[i];
+        glm::mat4 viewProjection = perspective((float)view.viewport[2] / MAX(view.viewport[3], 1)) * view.view;
+        raymarchShader.setMatrix4("viewProjection", viewProjection);
+        raymarchShader.setMatrix4("inverseViewProjection", glm::inverse(viewProjection));
+        raymarchShader.setVector3f("eye", view.eye);
+        glViewport(view.viewport[0], view.viewport[1], view.viewport[2], view.viewport[3]);
+        gl::drawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    gl::bindVertexArray(0);
+}
+
+bool Maze::bindShading()
+{
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindTexture(GL_TEXTURE_2D_ARRAY, wallTexture_D);
+    glActiveTexture(GL_TEXTURE1);
+    gl::bindTexture(GL_TEXTURE_2D_ARRAY, wallTexture_N);
+    // once the static lights are baked, only the moving ones are left for the light grid
+    bool baked = lightmap.poll();
+    lights.setStaticBaked(baked);
+    if (baked) {
+        glActiveTexture(GL_TEXTURE5);
+        gl::bindTexture(GL_TEXTURE_2D, lightmap.texture());
+    }
+    lights.update();
+    lights.bind(2);
+    return baked;
+}
+
+void Maze::finishLoading()
+{
+    textureUpload->wait();
+    meshUpload->wait();
+    isLoaded();
+}
+
+bool Maze::isLoaded()
+{
+    if (VAO) {
+        return true;
+    }
+    if (!textureUpload->isReady() || !meshUpload->isReady()) {
+        return false;
+    }
+
+    // vertex arrays are not shared between contexts, so this one is made here on the render thread
+    TRACE_ZONE("adopt maze mesh");
+    ranges.swap(mesh->ranges);
+    occluders.swap(mesh->occluders);
+    numPoints = mesh->numPoints;
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &indirectBuffer);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+
+    // position attribute
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)0);
+    glEnableVertexAttribArray(0);
+    // texture coord attribute
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(sizeof(glm::vec3)));
+    glEnableVertexAttribArray(1);
+    // normal attribute
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
+    glEnableVertexAttribArray(2);
+    // material attribute
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(VertexData), (void*)(sizeof(glm::vec3) * 2 + sizeof(glm::vec2)));
+    glEnableVertexAttribArray(3);
+    // lightmap coord attribute
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(sizeof(glm::vec3) * 2 + sizeof(glm::vec2) + sizeof(GLuint)));
+    glEnableVertexAttribArray(4);
+    // view attribute, one per instance, which the multi-draw commands pick through their base instance.
+    // It is only enabled for split screen, otherwise it is set for every view in turn instead. Without
+    // base instances every command would start at the first view, so the views are drawn one by one then.
+    if (hasMultiDrawIndirect && hasViewportArrays && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance)) {
+        glGenBuffers(1, &viewIndexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, viewIndexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * viewIndices.size(), &viewIndices[0], GL_STATIC_DRAW);
+        glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+        glVertexAttribDivisor(5, 1);
+    }
+    glBindVertexArray(0);
+
+    CONSOLE_DEBUG("Maze [%p] adopted its mesh.", this);
+    return true;
+}
+
+void Maze::cullRanges(int viewIndex, const glm::mat4 &viewProjection, const glm::vec3 &eye)
+{
+    glm::vec4 planes[6];
+    for (int i = 0; i < 3; ++i) {
+        planes[i * 2] = glm::row(viewProjection, 3) + glm::row(viewProjection, i);
+        planes[i * 2 + 1] = glm::row(viewProjection, 3) - glm::row(viewProjection, i);
+    }
+
+    // the walls nearest to the eye hide the most, so only those are used as occluders
+    occluderDistances.clear();
+    for (std::vector<Occluder>::const_iterator it = occluders.cbegin(); it != occluders.cend(); ++it) {
+        if (isBoxInFrustum(planes, it->min, it->max)) {
+            glm::vec3 closest = glm::clamp(eye, it->min, it->max);
+            occluderDistances.push_back(std::make_pair(glm::dot(closest - eye, closest - eye), &*it));
+        }
+    }
+    if (occluderDistances.size() > MAX_OCCLUDERS) {
+        std::nth_element(occluderDistances.begin(), occluderDistances.begin() + MAX_OCCLUDERS, occluderDistances.end());
+        occluderDistances.resize(MAX_OCCLUDERS);
+    }
+    nearestOccluders.clear();
+    for (std::vector<std::pair<float, const Occluder*> >::const_iterator it = occluderDistances.cbegin(); it != occluderDistances.cend(); ++it) {
+        nearestOccluders.push_back(it->second);
+    }
+    OcclusionBuffer &occlusionBuffer = occlusionBuffers[viewIndex];
+    occlusionBuffer.render(viewProjection, nearestOccluders);
+
+    for (std::vector<DrawRange>::size_type i = 0; i < ranges.size(); ++i) {
+        const DrawRange &range = ranges[i];
+        if (i > 0 && (!isBoxInFrustum(planes, range.min, range.max) || !isRangeFacingEye(range, eye) ||
+                      !occlusionBuffer.isBoxVisible(range.min, range.max))) {
+            continue;
+        }
+        rangeViews[i] |= 1u << viewIndex;
+    }
+}
+
+void Maze::drawRanges(unsigned int viewMask)
+{
+    commands.clear();
+    GLuint triangles = 0;
+    for (std::vector<DrawRange>::size_type i = 0; i < ranges.size(); ++i) {
+        unsigned int views = rangeViews[i] & viewMask;
+        if (!views) {
+            continue;
+        }
+        const DrawRange &range = ranges[i];
+        triangles += range.count / 3 * maskViewCount[views];
+        // the base instance must stay zero where it is not supported, which only leaves a view at a time to draw
+        GLuint baseInstance = viewIndexBuffer ? maskFirstInstance[views] : 0;
+        // ranges are laid out back to back, so neighbouring ranges visible in the same views collapse into one command
+        if (!commands.empty() && commands.back().baseInstance == baseInstance &&
+            commands.back().firstIndex + commands.back().count == range.firstIndex) {
+            commands.back().count += range.count;
+        }
+        else {
+            commands.push_back({ range.count, maskViewCount[views], range.firstIndex, 0, baseInstance });
+        }
+    }
+    if (commands.empty()) {
+        return;
+    }
 
-        wallTexture_D = makeTexture("./resources/textures/wall_diffuse.jpg");
-        wallTexture_N = makeTexture("./resources/textures/wall_normal.jpg");
+    if (hasMultiDrawIndirect) {
+        gl::bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * commands.size(), &commands[0], GL_STREAM_DRAW);
+        gl::multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, commands.size(), 0, triangles);
+        gl::bindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    else {
+        // only ever given a single view, which is set as a constant attribute
+        std::vector<GLsizei> counts(commands.size());
+        std::vector<const void*> offsets(commands.size());
+        for (std::vector<DrawElementsIndirectCommand>::size_type i = 0; i < commands.size(); ++i) {
+            counts[i] = commands[i].count;
+            offsets[i] = (const void*)(sizeof(GLuint) * commands[i].firstIndex);
+        }
+        gl::multiDrawElements(GL_TRIANGLES, &counts[0], GL_UNSIGNED_INT, &offsets[0], commands.size());
     }
+}
 
+std::vector<GLuint> Maze::rayCells(const bool *walls)
+{
+    std::vector<GLuint> cells(RAY_CELLS_X * RAY_CELLS_Y, 0);
+    // the walls are scattered over the materials run by run, the same way as in the mesh
+    for (int x = 0; x < RAY_CELLS_X; ++x) {
+        int startY = -1;
+        for (int y = 0; y < MAZE_HEIGHT; ++y) {
+            // the right outer wall leaves the exit open next to the last cell
+            bool wall = x == 0 || (x == MAZE_WIDTH ? y != MAZE_HEIGHT - 1 : walls[y * 2 * MAZE_WIDTH + x]);
+            if (!wall) {
+                startY = -1;
+                continue;
+            }
+            if (startY == -1) {
+                startY = y;
+            }
+            GLuint material = x == 0 || x == MAZE_WIDTH ? 0 : runMaterial(x, startY, 0);
+            cells[y * RAY_CELLS_X + x] |= RAY_LEFT_WALL | material << RAY_LEFT_MATERIAL_SHIFT;
+        }
+    }
+    for (int y = 0; y < RAY_CELLS_Y; ++y) {
+        int startX = -1;
+        for (int x = 0; x < MAZE_WIDTH; ++x) {
+            bool wall = y == 0 || y == MAZE_HEIGHT || walls[(y * 2 - 1) * MAZE_WIDTH + x];
+            if (!wall) {
+                startX = -1;
+                continue;
+            }
+            if (startX == -1) {
+                startX = x;
+            }
+            GLuint material = y == 0 || y == MAZE_HEIGHT ? 0 : runMaterial(startX, y * 2 - 1, 1);
+            cells[y * RAY_CELLS_X + x] |= RAY_TOP_WALL | material << RAY_TOP_MATERIAL_SHIFT;
+        }
+    }
+    // a corner is filled when any wall runs into it, except the one past the exit, which the outer walls stop short of
+    for (int y = 0; y < RAY_CELLS_Y; ++y) {
+        for (int x = 0; x < RAY_CELLS_X; ++x) {
+            if (x == MAZE_WIDTH && y == MAZE_HEIGHT) {
+                continue;
+            }
+            const int neighbours[4][3] = {
+                { x, y, RAY_LEFT_WALL }, { x, y - 1, RAY_LEFT_WALL }, { x, y, RAY_TOP_WALL }, { x - 1, y, RAY_TOP_WALL }
+            };
+            for (int i = 0; i < 4; ++i) {
+                if (neighbours[i][0] < 0 || neighbours[i][1] < 0) {
+                    continue;
+                }
+                GLuint bits = cells[neighbours[i][1] * RAY_CELLS_X + neighbours[i][0]];
+                if (bits & neighbours[i][2]) {
+                    GLuint material = (bits >> (neighbours[i][2] == RAY_LEFT_WALL ? RAY_LEFT_MATERIAL_SHIFT : RAY_TOP_MATERIAL_SHIFT)) & 0xff;
+                    cells[y * RAY_CELLS_X + x] |= RAY_CORNER | material << RAY_CORNER_MATERIAL_SHIFT;
+                    break;
+                }
+            }
+        }
+    }
+    return cells;
+}
+
+glm::mat4 Maze::perspective(float aspectRatio)
+{
+    return glm::perspective(glm::radians(60.0f), aspectRatio, 0.05f, (WALL_SIZE + WALL_THICKNESS) * MAX(MAZE_WIDTH, MAZE_HEIGHT));
+}
+
+static void loadMesh(const std::vector<bool> &walls, MazeMesh *mesh)
+{
+    TRACE_ZONE("build maze mesh");
     // inner walls
     std::vector<VertexData> vertices;
-    std::vector<GLuint> indices;
+    GLuint material = 0;
+    std::vector<MeshChunk> chunks(1 + CHUNKS_X * CHUNKS_Y * CHUNK_DIRECTIONS, { {}, glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), glm::vec3(0.0f) });
     VertexData v[4];
     const glm::vec3 normalX = { 1.0f, 0.0f, 0.0f }, normalZ = { 0.0f, 0.0f, -1.0f }, normalY = { 0.0f, 1.0f, 0.0f };
 
     const float columnTextureSize = 1.0f * WALL_THICKNESS / WALL_SIZE;
 
-    // floor
-    vertices.push_back( { { 0.0f, 0.0f, 0.0f }, { 0.0f, MAZE_HEIGHT }, normalY } );
-    vertices.push_back( { { 0.0f, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, normalY } );
-    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, 0.0f }, { MAZE_WIDTH, MAZE_HEIGHT }, normalY } );
-    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { MAZE_WIDTH, 0.0f }, normalY } );
+    // floor, the lightmap coordinates of every vertex are filled in once the mesh is done
+    vertices.push_back( { { 0.0f, 0.0f, 0.0f }, { 0.0f, MAZE_HEIGHT }, normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { 0.0f, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, 0.0f }, { MAZE_WIDTH, MAZE_HEIGHT }, normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { MAZE_WIDTH, 0.0f }, normalY, 0, glm::vec2(0.0f) } );
     // ceiling
-    vertices.push_back( { { 0.0f, WALL_SIZE, 0.0f }, { 0.0f, MAZE_HEIGHT }, -normalY } );
-    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, 0.0f }, { MAZE_WIDTH, MAZE_HEIGHT }, -normalY } );
-    vertices.push_back( { { 0.0f, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, -normalY } );
-    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { MAZE_WIDTH, 0.0f }, -normalY } );
-    
+    vertices.push_back( { { 0.0f, WALL_SIZE, 0.0f }, { 0.0f, MAZE_HEIGHT }, -normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, 0.0f }, { MAZE_WIDTH, MAZE_HEIGHT }, -normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { 0.0f, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, -normalY, 0, glm::vec2(0.0f) } );
+    vertices.push_back( { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { MAZE_WIDTH, 0.0f }, -normalY, 0, glm::vec2(0.0f) } );
+    chunks[0].indices = { 0, 1, 2, 2, 1, 3, 4, 5, 6, 6, 5, 7 };
+
     // vertical walls
 
     for (int x = 1; x < MAZE_WIDTH; ++x) {
@@ -170,36 +806,38 @@ Maze::Maze(bool *walls)
                 endY = y / 2;
             }
             else if (startY != -1) {
-                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { startY * (1.0f + columnTextureSize) - columnTextureSize, 1.0f }, normalX };
-                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * endY + WALL_SIZE + WALL_THICKNESS}, { endY * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 1.0f }, normalX };
-                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { startY * (1.0f + columnTextureSize) - columnTextureSize, 0.0f }, normalX };
-                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * endY + WALL_SIZE + WALL_THICKNESS }, { endY * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 0.0f }, normalX };
+                material = runMaterial(x, startY, 0);
+                // the middle of the wall, minus the columns at its ends, hides everything behind it
+                mesh->occluders.push_back(makeOccluder({ (WALL_SIZE + WALL_THICKNESS) * x - HALF_WALL_THICKNESS, 0.0f, (WALL_SIZE + WALL_THICKNESS) * startY },
+                                                 { (WALL_SIZE + WALL_THICKNESS) * x - HALF_WALL_THICKNESS, 0.0f, (WALL_SIZE + WALL_THICKNESS) * endY + WALL_SIZE }));
+
+                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { startY * (1.0f + columnTextureSize) - columnTextureSize, 1.0f }, normalX, material, glm::vec2(0.0f) };
+                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * endY + WALL_SIZE + WALL_THICKNESS}, { endY * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 1.0f }, normalX, material, glm::vec2(0.0f) };
+                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { startY * (1.0f + columnTextureSize) - columnTextureSize, 0.0f }, normalX, material, glm::vec2(0.0f) };
+                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * endY + WALL_SIZE + WALL_THICKNESS }, { endY * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 0.0f }, normalX, material, glm::vec2(0.0f) };
 
-                INSERT_CLOCKWISE();
+                INSERT_CLOCKWISE(chunkIndices(chunks, v));
                 
-                for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+                for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
                     v[k].position.x -= WALL_THICKNESS;
                     v[k].normal *= -1;
                 }
-                INSERT_COUNTERCLOCKWISE();
-                numPoints += 12;
+                INSERT_COUNTERCLOCKWISE(chunkIndices(chunks, v));
 
-                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x - WALL_THICKNESS, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize), 1.0f }, normalZ };
-                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize) + columnTextureSize, 1.0f }, normalZ };
-                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x - WALL_THICKNESS, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize), 0.0f }, normalZ };
-                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize) + columnTextureSize, 0.0f }, normalZ };
+                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x - WALL_THICKNESS, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize), 1.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize) + columnTextureSize, 1.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x - WALL_THICKNESS, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize), 0.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * x, 0, (WALL_SIZE + WALL_THICKNESS) * startY - WALL_THICKNESS }, { x * (1.0f + columnTextureSize) + columnTextureSize, 0.0f }, normalZ, material, glm::vec2(0.0f) };
                 
                 if (startY > 0 && !walls[(startY * 2 - 1) * MAZE_WIDTH + (x - 1)] && !walls[(startY * 2 - 1) * MAZE_WIDTH + x]) {
-                    INSERT_CLOCKWISE();
-                    numPoints += 6;
+                    INSERT_CLOCKWISE(chunkIndices(chunks, v));
                 }
                 if (endY < MAZE_HEIGHT - 1 && !walls[(endY * 2 + 1) * MAZE_WIDTH + (x - 1)] && !walls[(endY * 2 + 1) * MAZE_WIDTH + x]) {
-                    for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+                    for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
                         v[k].position.z = (WALL_SIZE + WALL_THICKNESS) * (endY + 1);
                         v[k].normal *= -1;
                     }
-                    INSERT_COUNTERCLOCKWISE();
-                    numPoints += 6;
+                    INSERT_COUNTERCLOCKWISE(chunkIndices(chunks, v));
                 }
 
                 endY = startY = -1;
@@ -220,36 +858,37 @@ Maze::Maze(bool *walls)
                 endX = x;
             }
             else if (startX != -1) {
-                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS , WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { startX * (1.0f + columnTextureSize) - columnTextureSize, 1.0f }, normalZ };
-                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * endX + WALL_SIZE + WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { endX * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 1.0f }, normalZ };
-                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { startX * (1.0f + columnTextureSize) - columnTextureSize, 0.0f }, normalZ };
-                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * endX + WALL_SIZE + WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { endX * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 0.0f }, normalZ };
+                material = runMaterial(startX, y, 1);
+                mesh->occluders.push_back(makeOccluder({ (WALL_SIZE + WALL_THICKNESS) * startX, 0.0f, (WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + HALF_WALL_THICKNESS },
+                                                 { (WALL_SIZE + WALL_THICKNESS) * endX + WALL_SIZE, 0.0f, (WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + HALF_WALL_THICKNESS }));
 
-                INSERT_CLOCKWISE();
+                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS , WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { startX * (1.0f + columnTextureSize) - columnTextureSize, 1.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * endX + WALL_SIZE + WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { endX * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 1.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { startX * (1.0f + columnTextureSize) - columnTextureSize, 0.0f }, normalZ, material, glm::vec2(0.0f) };
+                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * endX + WALL_SIZE + WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { endX * (1.0f + columnTextureSize) + 1.0f + columnTextureSize, 0.0f }, normalZ, material, glm::vec2(0.0f) };
+
+                INSERT_CLOCKWISE(chunkIndices(chunks, v));
                 
-                for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+                for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
                     v[k].position.z += WALL_THICKNESS;
                     v[k].normal *= -1;
                 }
-                INSERT_COUNTERCLOCKWISE();
-                numPoints += 12;
+                INSERT_COUNTERCLOCKWISE(chunkIndices(chunks, v));
 
-                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE)}, { x * (1.0f + columnTextureSize), 1.0f }, -normalX };
-                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + WALL_THICKNESS) }, { x * (1.0f + columnTextureSize) + columnTextureSize, 1.0f }, -normalX };
-                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { x * (1.0f + columnTextureSize), 0.0f }, -normalX };
-                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + WALL_THICKNESS) }, { x * (1.0f + columnTextureSize) + columnTextureSize, 0.0f }, -normalX };
+                v[TOP_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE)}, { x * (1.0f + columnTextureSize), 1.0f }, -normalX, material, glm::vec2(0.0f) };
+                v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, WALL_SIZE, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + WALL_THICKNESS) }, { x * (1.0f + columnTextureSize) + columnTextureSize, 1.0f }, -normalX, material, glm::vec2(0.0f) };
+                v[BOTTOM_LEFT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE) }, { x * (1.0f + columnTextureSize), 0.0f }, -normalX, material, glm::vec2(0.0f) };
+                v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * startX - WALL_THICKNESS, 0, ((WALL_SIZE + WALL_THICKNESS) * (y / 2) + WALL_SIZE + WALL_THICKNESS) }, { x * (1.0f + columnTextureSize) + columnTextureSize, 0.0f }, -normalX, material, glm::vec2(0.0f) };
                 
                 if (startX > 0 && !walls[(y - 1) * MAZE_WIDTH + startX] && !walls[(y + 1) * MAZE_WIDTH + startX]) {
-                    INSERT_COUNTERCLOCKWISE();
-                    numPoints += 6;
+                    INSERT_COUNTERCLOCKWISE(chunkIndices(chunks, v));
                 }
                 if (endX < MAZE_WIDTH - 1 && !walls[(y - 1) * MAZE_WIDTH + endX + 1] && !walls[(y + 1) * MAZE_WIDTH + endX + 1]) {
-                    for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+                    for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
                         v[k].position.x = (WALL_SIZE + WALL_THICKNESS) * (endX + 1);
                         v[k].normal *= -1;
                     }
-                    INSERT_CLOCKWISE();
-                    numPoints += 6;
+                    INSERT_CLOCKWISE(chunkIndices(chunks, v));
                 }
                 endX = startX = -1;
             }
@@ -257,91 +896,65 @@ Maze::Maze(bool *walls)
     }
 
     // top outer wall
-    v[TOP_LEFT_INDEX] = { { 0.0f, WALL_SIZE, 0.0f }, { 0.0f, 1.0f }, -normalZ };
-    v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, 0.0f }, { MAZE_WIDTH, 1.0f }, -normalZ };
-    v[BOTTOM_LEFT_INDEX] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f }, -normalZ };
-    v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, 0.0f }, { MAZE_WIDTH, 0.0f }, -normalZ };
-    INSERT_COUNTERCLOCKWISE();
+    material = 0;
+    v[TOP_LEFT_INDEX] = { { 0.0f, WALL_SIZE, 0.0f }, { 0.0f, 1.0f }, -normalZ, material, glm::vec2(0.0f) };
+    v[TOP_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, WALL_SIZE, 0.0f }, { MAZE_WIDTH, 1.0f }, -normalZ, material, glm::vec2(0.0f) };
+    v[BOTTOM_LEFT_INDEX] = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f }, -normalZ, material, glm::vec2(0.0f) };
+    v[BOTTOM_RIGHT_INDEX] = { { (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS, 0.0f, 0.0f }, { MAZE_WIDTH, 0.0f }, -normalZ, material, glm::vec2(0.0f) };
+    INSERT_COUNTERCLOCKWISE(chunks[0].indices);
 
     // bottom outer wall
-    for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+    for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
         v[k].position.z = (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS;
         v[k].normal *= -1;
     }
-    INSERT_CLOCKWISE();
+    INSERT_CLOCKWISE(chunks[0].indices);
 
     // left outer wall
-    v[TOP_LEFT_INDEX] = { { 0.0f, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 1.0f }, normalX };
-    v[TOP_RIGHT_INDEX] = { { 0.0f, WALL_SIZE, 0.0f }, { MAZE_HEIGHT, 1.0f }, normalX };
-    v[BOTTOM_LEFT_INDEX] = { { 0.0f, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, normalX };
-    v[BOTTOM_RIGHT_INDEX] = { { 0.0f, 0.0f, 0.0f }, { MAZE_HEIGHT, 0.0f }, normalX };
-    INSERT_COUNTERCLOCKWISE();
+    v[TOP_LEFT_INDEX] = { { 0.0f, WALL_SIZE, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 1.0f }, normalX, material, glm::vec2(0.0f) };
+    v[TOP_RIGHT_INDEX] = { { 0.0f, WALL_SIZE, 0.0f }, { MAZE_HEIGHT, 1.0f }, normalX, material, glm::vec2(0.0f) };
+    v[BOTTOM_LEFT_INDEX] = { { 0.0f, 0.0f, (WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS }, { 0.0f, 0.0f }, normalX, material, glm::vec2(0.0f) };
+    v[BOTTOM_RIGHT_INDEX] = { { 0.0f, 0.0f, 0.0f }, { MAZE_HEIGHT, 0.0f }, normalX, material, glm::vec2(0.0f) };
+    INSERT_COUNTERCLOCKWISE(chunks[0].indices);
 
     // right outer wall
-    for (int k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
+    for (size_t k = 0; k < sizeof(v) / sizeof(v[0]); ++k) {
         v[k].position.x = (WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS;
         v[k].normal *= -1;
     }
     v[TOP_LEFT_INDEX].position.z -= WALL_SIZE;
     v[BOTTOM_LEFT_INDEX].position.z -= WALL_SIZE;
-    INSERT_CLOCKWISE();
-
-    numPoints += 24;
+    INSERT_CLOCKWISE(chunks[0].indices);
 
-    CONSOLE_DEBUG("Vertices count: %lu", vertices.size());
-    CONSOLE_DEBUG("Points count: %d", numPoints);
+    // lay the chunks out one after the other in the element buffer
+    std::vector<GLuint> indices;
+    for (std::vector<MeshChunk>::const_iterator it = chunks.cbegin(); it != chunks.cend(); ++it) {
+        if (it->indices.empty()) {
+            continue;
+        }
+        mesh->ranges.push_back({ (GLuint)indices.size(), (GLuint)it->indices.size(), it->min, it->max, it->normal });
+        indices.insert(indices.end(), it->indices.cbegin(), it->indices.cend());
+    }
+    mesh->numPoints = indices.size();
 
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+    // the lightmap covers the maze from above, every surface reads it one texel in front of itself
+    const glm::vec2 mazeSize = glm::vec2(MAZE_WIDTH, MAZE_HEIGHT) * (WALL_SIZE + WALL_THICKNESS);
+    for (std::vector<VertexData>::iterator it = vertices.begin(); it != vertices.end(); ++it) {
+        glm::vec3 position = it->position + it->normal * ((WALL_SIZE + WALL_THICKNESS) / LIGHTMAP_TEXELS_PER_CELL);
+        it->lightmapCoords = glm::vec2(position.x, position.z) / mazeSize;
+    }
 
-    glBindVertexArray(VAO);
+    CONSOLE_DEBUG("Vertices count: %lu", vertices.size());
+    CONSOLE_DEBUG("Points count: %d", mesh->numPoints);
 
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glGenBuffers(1, &mesh->VBO);
+    glGenBuffers(1, &mesh->EBO);
+    // without a vertex array bound, the element buffer is filled through the array buffer binding
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(VertexData) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)0);
-    glEnableVertexAttribArray(0);
-    // texture coord attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(sizeof(glm::vec3)));
-    glEnableVertexAttribArray(1);
-    // normal attribute
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
-    glEnableVertexAttribArray(2);
-    
-    CONSOLE_DEBUG("Maze [%p] created.", this);
-}
-
-Maze::~Maze()
-{
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteBuffers(1, &EBO);
-
-    CONSOLE_DEBUG("Maze [%p] destroyed.", this);
-}
-
-void Maze::draw()
-{
-    mazeShader.use();
-    // create transformations
-    glm::mat4 view = player.getViewMatrix();
-    mazeShader.setMatrix4("view", view);
-    mazeShader.setVector3f("lightPos", player.Position);
-    glBindVertexArray(VAO);
-    // bind Texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, wallTexture_D);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, wallTexture_N);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glDrawArrays(GL_TRIANGLE_STRIP, 4, 4);
-    glDrawElements(GL_TRIANGLES, numPoints, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->EBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 static void insertVertex(std::vector<VertexData> &vertices, std::vector<GLuint> &indices, const VertexData &point)
@@ -359,31 +972,54 @@ static void insertVertex(std::vector<VertexData> &vertices, std::vector<GLuint>
     indices.push_back(index);
 }
 
-static unsigned int makeTexture(const char *texturePath)
+static std::vector<GLuint> &chunkIndices(std::vector<MeshChunk> &chunks, const VertexData *face)
 {
-    // load and create a texture 
-    // -------------------------
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture); // all upcoming GL_TEXTURE_2D operations now have effect on this texture object
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int w, h, nrChannels;
-    
-    stbi_set_flip_vertically_on_load(true); 
-    unsigned char *data = stbi_load(texturePath, &w, &h, &nrChannels, 0);
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    static const float chunkSize = (WALL_SIZE + WALL_THICKNESS) * MAZE_CHUNK_SIZE;
+    // a face belongs to the chunk that contains its center, and the chunk bounds grow to enclose it
+    glm::vec3 center = (face[TOP_LEFT_INDEX].position + face[BOTTOM_RIGHT_INDEX].position) * 0.5f;
+    int x = MIN(MAX((int)(center.x / chunkSize), 0), CHUNKS_X - 1);
+    int y = MIN(MAX((int)(center.z / chunkSize), 0), CHUNKS_Y - 1);
+    const glm::vec3 &normal = face[TOP_LEFT_INDEX].normal;
+    int direction = normal.x > 0 ? 0 : normal.x < 0 ? 1 : normal.z > 0 ? 2 : 3;
+    MeshChunk &chunk = chunks[1 + (y * CHUNKS_X + x) * CHUNK_DIRECTIONS + direction];
+    chunk.normal = normal;
+    for (int k = 0; k < 4; ++k) {
+        chunk.min = glm::min(chunk.min, face[k].position);
+        chunk.max = glm::max(chunk.max, face[k].position);
     }
-    else {
-        CONSOLE_ERROR("Failed to load texture");
+    return chunk.indices;
+}
+
+static bool isBoxInFrustum(const glm::vec4 *planes, const glm::vec3 &min, const glm::vec3 &max)
+{
+    for (int i = 0; i < 6; ++i) {
+        // only the corner that lies furthest along the plane normal needs to be tested
+        glm::vec3 corner(planes[i].x > 0 ? max.x : min.x, planes[i].y > 0 ? max.y : min.y, planes[i].z > 0 ? max.z : min.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0) {
+            return false;
+        }
     }
-    stbi_image_free(data);
-    return texture;
-}
\ No newline at end of file
+    return true;
+}
+
+static bool isRangeFacingEye(const Maze::DrawRange &range, const glm::vec3 &eye)
+{
+    // all faces of the range share the normal, so if the eye is behind the rearmost
+    // of their planes, every one of them would be back face culled anyway
+    glm::vec3 rearmost(range.normal.x > 0 ? range.min.x : range.max.x, 0.0f, range.normal.z > 0 ? range.min.z : range.max.z);
+    return glm::dot(range.normal, eye) > glm::dot(range.normal, rearmost);
+}
+
+static Occluder makeOccluder(const glm::vec3 &start, const glm::vec3 &end)
+{
+    const glm::vec3 up(0.0f, WALL_SIZE, 0.0f);
+    Occluder occluder = { { start, end, end + up, start + up }, glm::min(start, end), glm::max(start, end) + up };
+    return occluder;
+}
+
+static GLuint runMaterial(int x, int y, int orientation)
+{
+    // scatter the materials over the wall runs, the same way for the same maze
+    unsigned int hash = (x * 73856093u) ^ (y * 19349663u) ^ (orientation * 83492791u);
+    return hash % MATERIAL_COUNT;
+}
@@ -24,13 +24,32 @@
 
 #include "minimap.h"
 #include "console.h"
-#include "player.h"
 #include "shader.h"
 #include "common.h"
+#include "glstate.h"
+#include "trace.h"
+#include "loader.h"
 
 #include <GL/glew.h>
 #include <vector>
 #include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// pixels around the minimap that the cache covers as well, for the wide lines on its border
+#define CACHE_MARGIN 2
+// rows of the wall grid, the even ones hold the vertical walls and the odd ones the horizontal walls
+#define WALL_ROWS (MAZE_HEIGHT * 2 - 1)
+// walls of a row that one texel of the bitmask holds, and the texels a row takes
+#define WALLS_PER_TEXEL 32
+#define BITMASK_WIDTH ((MAZE_WIDTH + WALLS_PER_TEXEL - 1) / WALLS_PER_TEXEL)
+// pixels a cell needs across for its walls to be drawn one by one, rather than the occupancy of the cells
+#define LOD_CELL_PIXELS 4
+// cells the zoomed in minimap shows at least across either side
+#define ZOOM_MIN_CELLS 4
+
+#define STRINGIFY(x) #x
+#define TO_STRING(x) STRINGIFY(x)
 
 struct VertexData2D
 {
@@ -44,22 +63,47 @@ bool operator==(const VertexData2D &lhs, const VertexData2D &rhs)
 }
 
 static Shader minimapShader;
-static VertexData2D playerData = { { 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+static Shader cacheShader;
+static Shader bitmaskShader;
+static VertexData2D playerData[MAX_PLAYERS] = {
+    { { 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+    { { 0.0f, 0.0f }, { 0.0f, 1.0f, 1.0f } },
+    { { 0.0f, 0.0f }, { 1.0f, 0.0f, 1.0f } },
+    { { 0.0f, 0.0f }, { 1.0f, 0.5f, 0.0f } }
+};
+
+// What the loader builds and uploads for a minimap. It is reference counted, because the
+// minimap may be destroyed while its upload is still queued.
+struct MinimapMesh
+{
+    GLuint VBO;
+    GLuint EBO;
+    GLuint numPoints;
+};
 
+static void loadMesh(const std::vector<bool> &walls, MinimapMesh *mesh);
 static void insertVertex(std::vector<VertexData2D> &vertices, std::vector<GLuint> &indices, const VertexData2D &point);
 
-Minimap::Minimap(bool *walls, glm::vec3 *playerPos)
-    : numPoints(0), playerPos(playerPos)
+Minimap::Minimap(const bool *walls, const std::vector<std::vector<unsigned char> > &occupancy, bool fromBitmask)
+    : VAO(0), numPoints(0), numPlayers(0), cacheFramebuffer(0), cacheTexture(0), wallTexture(0), occupancyTexture(0), zoom(0), cameraOrigin(0.0f), cacheZoom(0), cacheOrigin(0.0f), explored(MAZE_WIDTH * MAZE_HEIGHT, 0), exploredTexture(0), mesh(std::make_shared<MinimapMesh>())
 {
-    if (minimapShader.id() == -1) {
+    memset(cacheViewport, 0, sizeof(cacheViewport));
+    memset(cacheRect, 0, sizeof(cacheRect));
+    if (minimapShader.id() == (GLuint)-1) {
+        // the walls are scaled up around the top left corner of the minimap, with the camera origin moved onto it.
+        // The player dots are placed in the zoomed in minimap already and drawn at a scale of 1.
         const char *vertexShaderSource = "#version 330 core\n"
             "layout (location = 0) in vec2 aPos;\n"
             "layout (location = 1) in vec3 color;\n"
             "out vec3 outColor;\n"
+            "uniform vec2 cameraOrigin;\n"
+            "uniform float cameraScale;\n"
             "void main()\n"
             "{\n"
+            "  vec2 corner = vec2(" TO_STRING(MINIMAP_X) ", " TO_STRING(MINIMAP_Y) ");\n"
+            "  vec2 origin = cameraOrigin * vec2(" TO_STRING(MINIMAP_WIDTH) ", -" TO_STRING(MINIMAP_HEIGHT) ");\n"
             "  outColor = color;\n"
-            "  gl_Position = vec4(aPos.x, aPos.y, 0.0, 1.0);\n"
+            "  gl_Position = vec4(corner + (aPos - corner - origin) * cameraScale, 0.0, 1.0);\n"
             "}\0";
         const char *fragmentShaderSource = "#version 330 core\n"
             "out vec4 FragColor;\n"
@@ -69,7 +113,428 @@ Minimap::Minimap(bool *walls, glm::vec3 *playerPos)
             "  FragColor = vec4(outColor, 0.7f);\n"
             "}\0";
         minimapShader.compile(vertexShaderSource, fragmentShaderSource);
+        minimapShader.setFloat("cameraScale", 1.0f, GL_TRUE);
+
+        // a quad over the given rectangle, copying the cache pixel for pixel where the maze is explored
+        const char *cacheVertexShaderSource = "#version 330 core\n"
+            "out vec2 MapCoord;\n"
+            "uniform vec4 rect;\n"
+            "void main()\n"
+            "{\n"
+            "  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+            "  gl_Position = vec4(mix(rect.xy, rect.zw, corner), 0.0, 1.0);\n"
+            "  MapCoord = vec2(gl_Position.x - " TO_STRING(MINIMAP_X) ", " TO_STRING(MINIMAP_Y) " - gl_Position.y) / vec2(" TO_STRING(MINIMAP_WIDTH) ", " TO_STRING(MINIMAP_HEIGHT) ");\n"
+            "}\0";
+        // the explored cells are filtered linearly, which keeps the walls on their border and fades out half a cell
+        // past them. The margin around the maze keeps the outer half of its frame.
+        const char *cacheFragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 MapCoord;\n"
+            "uniform sampler2D cache;\n"
+            "uniform sampler2D explored;\n"
+            "uniform vec2 origin;\n"
+            "uniform vec2 cameraOrigin;\n"
+            "uniform float cameraScale;\n"
+            "void main()\n"
+            "{\n"
+            "  bool inside = all(greaterThanEqual(MapCoord, vec2(0.0))) && all(lessThanEqual(MapCoord, vec2(1.0)));\n"
+            "  float seen = inside ? clamp(texture(explored, cameraOrigin + MapCoord / cameraScale).r * 2.0, 0.0, 1.0) : 1.0;\n"
+            "  FragColor = mix(vec4(0.0, 0.0, 0.0, 0.7), texelFetch(cache, ivec2(gl_FragCoord.xy - origin), 0), seen);\n"
+            "}\0";
+        cacheShader.compile(cacheVertexShaderSource, cacheFragmentShaderSource);
+        cacheShader.setInteger("cache", 0, GL_TRUE);
+        cacheShader.setInteger("explored", 1);
+
+        // the same quad over the part of the map the camera shows, deciding for each pixel whether it lies within a
+        // line's width of a wall. The lines are two pixels wide, which is as many cells as the map coordinates change
+        // over a pixel on either side. Once the cells get smaller than that, the quadtree level with about a texel per
+        // pixel shades the pixel by the share of walls under it.
+        const char *bitmaskFragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 MapCoord;\n"
+            "uniform usampler2D walls;\n"
+            "uniform sampler2D explored;\n"
+            "uniform sampler2D occupancy;\n"
+            "uniform vec2 cameraOrigin;\n"
+            "uniform float cameraScale;\n"
+            "bool wall(int x, int row)\n"
+            "{\n"
+            "  if (x < 0 || x >= " TO_STRING(MAZE_WIDTH) " || row < 0 || row >= " TO_STRING(WALL_ROWS) ") {\n"
+            "    return false;\n"
+            "  }\n"
+            "  uint bits = texelFetch(walls, ivec2(x / " TO_STRING(WALLS_PER_TEXEL) ", row), 0).r;\n"
+            "  return ((bits >> uint(x % " TO_STRING(WALLS_PER_TEXEL) ")) & 1u) != 0u;\n"
+            "}\n"
+            "void main()\n"
+            "{\n"
+            "  vec2 size = vec2(" TO_STRING(MAZE_WIDTH) ", " TO_STRING(MAZE_HEIGHT) ");\n"
+            "  vec2 map = cameraOrigin + MapCoord / cameraScale;\n"
+            "  vec2 cell = map * size;\n"
+            "  vec2 footprint = fwidth(cell);\n"
+            "  ivec2 current = ivec2(floor(cell));\n"
+            "  ivec2 line = ivec2(round(cell));\n"
+            "  bvec2 near = lessThan(abs(cell - vec2(line)), footprint);\n"
+            "  bool inside = all(greaterThanEqual(MapCoord, vec2(0.0))) && all(lessThanEqual(MapCoord, vec2(1.0)));\n"
+            "  float lod = log2(max(footprint.x, footprint.y));\n"
+            "  bool exact = inside && lod < -log2(" TO_STRING(LOD_CELL_PIXELS) ".0);\n"
+            "  bool isWall = false;\n"
+            "  // the frame leaves the last cell of the right side open, that is the exit. Nothing else is drawn past the window.\n"
+            "  if (near.x && cell.y >= 0.0 && cell.y <= size.y) {\n"
+            "    isWall = line.x == 0 || (line.x == int(size.x) && cell.y <= size.y - 1.0) || (exact && wall(line.x, current.y * 2));\n"
+            "  }\n"
+            "  if (near.y && cell.x >= 0.0 && cell.x <= size.x) {\n"
+            "    isWall = isWall || line.y == 0 || line.y == int(size.y) || (exact && wall(current.x, line.y * 2 - 1));\n"
+            "  }\n"
+            "  // premultiplied, the walls blended over the background the way the cache has them\n"
+            "  vec4 background = vec4(0.0, 0.0, 0.0, 0.7);\n"
+            "  vec4 wallColor = vec4(0.7, 0.7, 0.0, inside ? 0.91 : 0.7);\n"
+            "  vec4 color = isWall ? wallColor : !inside ? vec4(0.0) : exact ? background : mix(background, wallColor, textureLod(occupancy, map, max(lod, 0.0)).r);\n"
+            "  float seen = inside ? clamp(texture(explored, map).r * 2.0, 0.0, 1.0) : 1.0;\n"
+            "  FragColor = mix(background, color, seen);\n"
+            "}\0";
+        bitmaskShader.compile(cacheVertexShaderSource, bitmaskFragmentShaderSource);
+        bitmaskShader.setInteger("walls", 0, GL_TRUE);
+        bitmaskShader.setInteger("explored", 1);
+        bitmaskShader.setInteger("occupancy", 2);
+    }
+    if (fromBitmask) {
+        // one bit per wall, a row of the grid packed into as many texels as it takes. Integer textures
+        // are never filtered, the shader fetches the texel and picks out the bit itself.
+        std::vector<GLuint> bits(BITMASK_WIDTH * WALL_ROWS, 0);
+        for (int row = 0; row < WALL_ROWS; ++row) {
+            for (int x = 0; x < MAZE_WIDTH; ++x) {
+                if (walls[row * MAZE_WIDTH + x]) {
+                    bits[row * BITMASK_WIDTH + x / WALLS_PER_TEXEL] |= 1u << (x % WALLS_PER_TEXEL);
+                }
+            }
+        }
+        glGenTextures(1, &wallTexture);
+        glBindTexture(GL_TEXTURE_2D, wallTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, BITMASK_WIDTH, WALL_ROWS, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &bits[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // the quadtree levels are the mipmaps of a single texture, whose sizes halve the same way
+        glGenTextures(1, &occupancyTexture);
+        glBindTexture(GL_TEXTURE_2D, occupancyTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t level = 0; level < occupancy.size(); ++level) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R8, MAX(MAZE_WIDTH >> level, 1), MAX(MAZE_HEIGHT >> level, 1), 0, GL_RED, GL_UNSIGNED_BYTE, &occupancy[level][0]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, occupancy.size() - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // there is nothing to load, the empty vertex array is only there to draw the quad with
+        glGenVertexArrays(1, &VAO);
+    }
+    else {
+        // the walls are built and uploaded by the loader, the minimap is drawn once it is done
+        std::shared_ptr<MinimapMesh> mesh = this->mesh;
+        std::vector<bool> wallsCopy(walls, walls + WALL_ROWS * MAZE_WIDTH);
+        meshUpload = ResourceLoader::Instance()->submit([mesh, wallsCopy]() { loadMesh(wallsCopy, mesh.get()); });
+    }
+
+    glGenVertexArrays(1, &player_VAO);
+    glGenBuffers(1, &player_VBO);
+    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+    glBindVertexArray(player_VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, player_VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(playerData), &playerData, GL_DYNAMIC_DRAW);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)(sizeof(glm::vec2)));
+    glEnableVertexAttribArray(1);
+
+    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
+    glBindBuffer(GL_ARRAY_BUFFER, 0); 
+
+    // remember: do NOT unbind the EBO while a VAO is active as the bound element buffer object IS stored in the VAO; keep the EBO bound.
+    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens. Modifying other
+    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
+    glBindVertexArray(0); 
+
+    // the whole maze starts out unexplored, the rows of the mask are packed tight
+    glGenTextures(1, &exploredTexture);
+    glBindTexture(GL_TEXTURE_2D, exploredTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, MAZE_WIDTH, MAZE_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, &explored[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glLineWidth(2);
+    glPointSize(7);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    CONSOLE_DEBUG("Minimap [%p] created.", this);
+}
+
+Minimap::~Minimap()
+{
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteVertexArrays(1, &player_VAO);
+    glDeleteBuffers(1, &player_VBO);
+    glDeleteFramebuffers(1, &cacheFramebuffer);
+    glDeleteTextures(1, &cacheTexture);
+    glDeleteTextures(1, &exploredTexture);
+    glDeleteTextures(1, &wallTexture);
+    glDeleteTextures(1, &occupancyTexture);
+    // the upload may still be queued, so the buffers are deleted on the loader right after it
+    if (meshUpload) {
+        std::shared_ptr<MinimapMesh> mesh = this->mesh;
+        ResourceLoader::Instance()->submit([mesh]() {
+            glDeleteBuffers(1, &mesh->VBO);
+            glDeleteBuffers(1, &mesh->EBO);
+        });
+    }
+
+    CONSOLE_DEBUG("Minimap [%p] destroyed.", this);
+}
+
+int Minimap::maxZoom()
+{
+    int zoom = 0;
+    while ((MIN(MAZE_WIDTH, MAZE_HEIGHT) >> (zoom + 1)) >= ZOOM_MIN_CELLS) {
+        ++zoom;
+    }
+    return zoom;
+}
+
+void Minimap::setZoom(int zoom)
+{
+    this->zoom = MIN(MAX(zoom, 0), maxZoom());
+}
+
+void Minimap::update(const glm::vec3 *playerPositions, int playerCount)
+{
+    numPlayers = MIN(playerCount, MAX_PLAYERS);
+    // from 0 to 1 across the whole maze
+    glm::vec2 mapped[MAX_PLAYERS];
+    for (int i = 0; i < numPlayers; ++i) {
+        mapped[i].x = playerPositions[i].x / ((WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS);
+        mapped[i].y = playerPositions[i].z / ((WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS);
+    }
+    // the camera follows the first player only as far as the border of the maze
+    float scale = (float)(1 << zoom);
+    cameraOrigin = numPlayers > 0 ? glm::clamp(mapped[0] - 0.5f / scale, 0.0f, 1.0f - 1.0f / scale) : glm::vec2(0.0f);
+    for (int i = 0; i < numPlayers; ++i) {
+        glm::vec2 shown = (mapped[i] - cameraOrigin) * scale;
+        if (shown.x < 0.0f || shown.x > 1.0f || shown.y < 0.0f || shown.y > 1.0f) {
+            // out of the window, a point whose center is off the screen is clipped altogether
+            playerData[i].position = glm::vec2(-2.0f);
+            continue;
+        }
+        playerData[i].position.x = shown.x * MINIMAP_WIDTH + MINIMAP_X;
+        playerData[i].position.y = -(shown.y * MINIMAP_HEIGHT - MINIMAP_Y);
+    }
+}
+
+void Minimap::shownArea(glm::vec2 *origin, float *scale) const
+{
+    *origin = cameraOrigin;
+    *scale = (float)(1 << zoom);
+}
+
+void Minimap::reveal(const int *cells, int count)
+{
+    TRACE_ZONE("reveal minimap");
+    int minX = MAZE_WIDTH, minY = MAZE_HEIGHT, maxX = -1, maxY = -1;
+    for (int i = 0; i < count; ++i) {
+        int x = cells[i] % MAZE_WIDTH, y = cells[i] / MAZE_WIDTH;
+        explored[cells[i]] = 255;
+        minX = MIN(minX, x);
+        minY = MIN(minY, y);
+        maxX = MAX(maxX, x);
+        maxY = MAX(maxY, y);
     }
+    if (maxX < 0) {
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    gl::bindTexture(GL_TEXTURE_2D, exploredTexture);
+    // only the rectangle around the new cells, read out of the whole mask
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, MAZE_WIDTH);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, minX, minY, maxX - minX + 1, maxY - minY + 1, GL_RED, GL_UNSIGNED_BYTE, &explored[minY * MAZE_WIDTH + minX]);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void Minimap::draw()
+{
+    TRACE_ZONE("draw minimap");
+    if (!isLoaded()) {
+        return;
+    }
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (cacheRect[2] == 0 || memcmp(viewport, cacheViewport, sizeof(viewport)) != 0) {
+        fitRect(viewport);
+        if (!wallTexture) {
+            renderCache(viewport);
+        }
+    }
+    // zoomed in, the line walls move along with the camera and are cached again whenever it does
+    else if (!wallTexture && (zoom != cacheZoom || cameraOrigin != cacheOrigin)) {
+        renderCache(viewport);
+    }
+    gl::disable(GL_DEPTH_TEST);
+    gl::enable(GL_BLEND);
+    // the cache holds the colors premultiplied by their coverage, and so does the bitmask pass
+    gl::blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    Shader &shader = wallTexture ? bitmaskShader : cacheShader;
+    shader.use();
+    shader.setVector4f("rect", (cacheRect[0] - viewport[0]) * 2.0f / viewport[2] - 1.0f,
+                               (cacheRect[1] - viewport[1]) * 2.0f / viewport[3] - 1.0f,
+                               (cacheRect[0] + cacheRect[2] - viewport[0]) * 2.0f / viewport[2] - 1.0f,
+                               (cacheRect[1] + cacheRect[3] - viewport[1]) * 2.0f / viewport[3] - 1.0f);
+    shader.setVector2f("cameraOrigin", cameraOrigin);
+    shader.setFloat("cameraScale", (float)(1 << zoom));
+    if (wallTexture) {
+        glActiveTexture(GL_TEXTURE2);
+        gl::bindTexture(GL_TEXTURE_2D, occupancyTexture);
+    }
+    else {
+        shader.setVector2f("origin", cacheRect[0], cacheRect[1]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindTexture(GL_TEXTURE_2D, wallTexture ? wallTexture : cacheTexture);
+    glActiveTexture(GL_TEXTURE1);
+    gl::bindTexture(GL_TEXTURE_2D, exploredTexture);
+    glActiveTexture(GL_TEXTURE0);
+    // the quad is made up in the shader, any vertex array does
+    gl::bindVertexArray(VAO);
+    gl::drawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    minimapShader.use();
+    minimapShader.setVector2f("cameraOrigin", 0.0f, 0.0f);
+    minimapShader.setFloat("cameraScale", 1.0f);
+    gl::bindBuffer(GL_ARRAY_BUFFER, player_VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexData2D) * numPlayers, playerData);
+    gl::bindVertexArray(player_VAO);
+    gl::drawArrays(GL_POINTS, 0, numPlayers);
+    gl::bindVertexArray(0);
+    gl::disable(GL_BLEND);
+    gl::enable(GL_DEPTH_TEST);
+}
+
+void Minimap::fitRect(const int *viewport)
+{
+    // the pixels of the viewport the minimap covers
+    int left = (int)floorf((MINIMAP_X + 1.0f) / 2.0f * viewport[2]) - CACHE_MARGIN;
+    int right = (int)ceilf((MINIMAP_X + MINIMAP_WIDTH + 1.0f) / 2.0f * viewport[2]) + CACHE_MARGIN;
+    int bottom = (int)floorf((MINIMAP_Y - MINIMAP_HEIGHT + 1.0f) / 2.0f * viewport[3]) - CACHE_MARGIN;
+    int top = (int)ceilf((MINIMAP_Y + 1.0f) / 2.0f * viewport[3]) + CACHE_MARGIN;
+    cacheRect[0] = viewport[0] + left;
+    cacheRect[1] = viewport[1] + bottom;
+    cacheRect[2] = right - left;
+    cacheRect[3] = top - bottom;
+    memcpy(cacheViewport, viewport, sizeof(cacheViewport));
+}
+
+void Minimap::renderCache(const int *viewport)
+{
+    TRACE_ZONE("cache minimap");
+    int left = cacheRect[0] - viewport[0];
+    int bottom = cacheRect[1] - viewport[1];
+    if (!cacheTexture) {
+        glGenTextures(1, &cacheTexture);
+        glGenFramebuffers(1, &cacheFramebuffer);
+    }
+    gl::bindTexture(GL_TEXTURE_2D, cacheTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheRect[2], cacheRect[3], 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    gl::bindFramebuffer(GL_FRAMEBUFFER, cacheFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, cacheTexture, 0);
+
+    // the viewport moved along with the cache, so that the walls land on the same pixels as they would on screen
+    glViewport(-left, -bottom, viewport[2], viewport[3]);
+    const GLfloat transparent[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, transparent);
+    gl::disable(GL_DEPTH_TEST);
+    gl::enable(GL_BLEND);
+    // blended the way they would be over the scene, and the coverage accumulated so that the cache is blended over it in turn
+    gl::blendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    minimapShader.use();
+    minimapShader.setVector2f("cameraOrigin", cameraOrigin);
+    minimapShader.setFloat("cameraScale", (float)(1 << zoom));
+    if (zoom > 0) {
+        // the background grows along with the walls, neither is drawn past the minimap itself, the
+        // walls running on out of it would leave their stubs in the margin
+        gl::enable(GL_SCISSOR_TEST);
+        glScissor(CACHE_MARGIN, CACHE_MARGIN, cacheRect[2] - CACHE_MARGIN * 2, cacheRect[3] - CACHE_MARGIN * 2);
+    }
+    gl::bindVertexArray(VAO);
+    gl::drawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl::drawElements(GL_LINES, numPoints, GL_UNSIGNED_INT, 0);
+    gl::bindVertexArray(0);
+    if (zoom > 0) {
+        gl::disable(GL_SCISSOR_TEST);
+    }
+    gl::blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    gl::disable(GL_BLEND);
+    gl::enable(GL_DEPTH_TEST);
+
+    gl::bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    cacheZoom = zoom;
+    cacheOrigin = cameraOrigin;
+    CONSOLE_DEBUG("Minimap [%p] cached %dx%d pixels.", this, cacheRect[2], cacheRect[3]);
+}
+
+void Minimap::finishLoading()
+{
+    if (meshUpload) {
+        meshUpload->wait();
+    }
+    isLoaded();
+}
+
+bool Minimap::isLoaded()
+{
+    if (VAO) {
+        return true;
+    }
+    if (!meshUpload->isReady()) {
+        return false;
+    }
+
+    // vertex arrays are not shared between contexts, so this one is made here on the render thread
+    numPoints = mesh->numPoints;
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)(sizeof(glm::vec2)));
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+    return true;
+}
+
+static void loadMesh(const std::vector<bool> &walls, MinimapMesh *mesh)
+{
+    TRACE_ZONE("build minimap");
+    mesh->numPoints = 0;
     // inner walls
     std::vector<VertexData2D> vertices;
     std::vector<GLuint> indices;
@@ -97,7 +562,7 @@ Minimap::Minimap(bool *walls, glm::vec3 *playerPos)
             else if (startY != -1) {
                 insertVertex(vertices, indices, { { w * x + MINIMAP_X, (h * startY - MINIMAP_Y) * -1 }, wallsColor });
                 insertVertex(vertices, indices, { { w * x + MINIMAP_X, (h * endY - MINIMAP_Y + h * 2) * -1 }, wallsColor });
-                numPoints += 2;
+                mesh->numPoints += 2;
                 endY = startY = -1;
             }
         }
@@ -117,7 +582,7 @@ Minimap::Minimap(bool *walls, glm::vec3 *playerPos)
             else if (startX != -1) {
                 insertVertex(vertices, indices, { { w * startX + MINIMAP_X, (h * y -  MINIMAP_Y + h) * -1 }, wallsColor });
                 insertVertex(vertices, indices, { { w * endX + MINIMAP_X + w, (h * y - MINIMAP_Y + h) * -1 }, wallsColor });
-                numPoints += 2;
+                mesh->numPoints += 2;
                 endX = startX = -1;
             }
         }
@@ -137,91 +602,19 @@ Minimap::Minimap(bool *walls, glm::vec3 *playerPos)
     insertVertex( vertices, indices, { vertices[2].position, wallsColor } ); // top right
     insertVertex( vertices, indices, { { vertices[3].position.x, vertices[3].position.t + h * 2.0f }, wallsColor } ); // bottom right
 
-    numPoints += 8;
+    mesh->numPoints += 8;
     
     CONSOLE_DEBUG("Vertices count: %lu", vertices.size());
-    CONSOLE_DEBUG("Points count: %d", numPoints);
+    CONSOLE_DEBUG("Points count: %d", mesh->numPoints);
     
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glGenBuffers(1, &mesh->VBO);
+    glGenBuffers(1, &mesh->EBO);
+    // without a vertex array bound, the element buffer is filled through the array buffer binding
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(VertexData2D) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (void*)(sizeof(glm::vec2)));
-    glEnableVertexAttribArray(1);
-    
-    glGenVertexArrays(1, &player_VAO);
-    glGenBuffers(1, &player_VBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(player_VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, player_VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(playerData), &playerData, GL_DYNAMIC_DRAW);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(playerData), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(playerData), (void*)(sizeof(glm::vec2)));
-    glEnableVertexAttribArray(1);
-
-    // note that this is allowed, the call to glVertexAttribPointer registered VBO as the vertex attribute's bound vertex buffer object so afterwards we can safely unbind
-    glBindBuffer(GL_ARRAY_BUFFER, 0); 
-
-    // remember: do NOT unbind the EBO while a VAO is active as the bound element buffer object IS stored in the VAO; keep the EBO bound.
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    // You can unbind the VAO afterwards so other VAO calls won't accidentally modify this VAO, but this rarely happens. Modifying other
-    // VAOs requires a call to glBindVertexArray anyways so we generally don't unbind VAOs (nor VBOs) when it's not directly necessary.
-    glBindVertexArray(0); 
-    glLineWidth(2);
-    glPointSize(7);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    CONSOLE_DEBUG("Minimap [%p] created.", this);
-}
-
-Minimap::~Minimap()
-{
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteVertexArrays(1, &player_VAO);
-    glDeleteBuffers(1, &player_VBO);
-    glDeleteBuffers(1, &EBO);
-
-    CONSOLE_DEBUG("Minimap [%p] destroyed.", this);
-}
-
-void Minimap::update()
-{
-    playerData.position.x = playerPos->x / ((WALL_SIZE + WALL_THICKNESS) * MAZE_WIDTH - WALL_THICKNESS) * MINIMAP_WIDTH + MINIMAP_X;
-    playerData.position.y = -(playerPos->z / ((WALL_SIZE + WALL_THICKNESS) * MAZE_HEIGHT - WALL_THICKNESS) * MINIMAP_HEIGHT - MINIMAP_Y);
-}
-
-void Minimap::draw()
-{
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    minimapShader.use();
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glDrawElements(GL_LINES, numPoints, GL_UNSIGNED_INT, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, player_VBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(playerData.position), &playerData.position);
-    glBindVertexArray(player_VAO);
-    glDrawArrays(GL_POINTS, 0, 1);
-    glBindVertexArray(0);
-    glDisable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->EBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), &indices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 static void insertVertex(std::vector<VertexData2D> &vertices, std::vector<GLuint> &indices, const VertexData2D &point)
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "occlusion.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the width must be a multiple of 4, so that rows can be processed in whole SIMD lanes
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 144
+#define OCCLUSION_BAND_HEIGHT 16
+
+OcclusionBuffer::OcclusionBuffer()
+{
+    m_depth = (float*)aligned_alloc(16, sizeof(float) * OCCLUSION_WIDTH * OCCLUSION_HEIGHT);
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+    free(m_depth);
+}
+
+void OcclusionBuffer::render(const glm::mat4 &viewProjection, const std::vector<const Occluder*> &occluders)
+{
+    TRACE_ZONE("rasterize occluders");
+    m_viewProjection = viewProjection;
+    setupPolygons(occluders);
+
+    // every band owns its rows of the buffer, so they can be rasterized without any locking
+    const int bands = (OCCLUSION_HEIGHT + OCCLUSION_BAND_HEIGHT - 1) / OCCLUSION_BAND_HEIGHT;
+    ThreadPool::Instance()->parallelFor(bands, [this](int band) {
+        rasterizeBand(band * OCCLUSION_BAND_HEIGHT, MIN((band + 1) * OCCLUSION_BAND_HEIGHT, OCCLUSION_HEIGHT));
+    });
+}
+
+bool OcclusionBuffer::isBoxVisible(const glm::vec3 &min, const glm::vec3 &max) const
+{
+    float minX = OCCLUSION_WIDTH, minY = OCCLUSION_HEIGHT, maxX = 0.0f, maxY = 0.0f, nearest = 0.0f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 clip = m_viewProjection * glm::vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.0f);
+        if (clip.z < -clip.w) {
+            // the box reaches the near plane, so it surely covers part of the view
+            return true;
+        }
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        float y = (clip.y * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        minX = MIN(minX, x);
+        minY = MIN(minY, y);
+        maxX = MAX(maxX, x);
+        maxY = MAX(maxY, y);
+        nearest = MAX(nearest, invW);
+    }
+
+    // every pixel the box touches at all, the occluders hold the farthest depth over each of them
+    int x0 = MAX((int)floorf(minX), 0), y0 = MAX((int)floorf(minY), 0);
+    int x1 = MIN((int)floorf(maxX) + 1, OCCLUSION_WIDTH), y1 = MIN((int)floorf(maxY) + 1, OCCLUSION_HEIGHT);
+
+    for (int y = y0; y < y1; ++y) {
+        const float *row = m_depth + y * OCCLUSION_WIDTH;
+#ifdef __SSE2__
+        const __m128 boxDepth = _mm_set1_ps(nearest);
+        const __m128i first = _mm_set1_epi32(x0 - 1), last = _mm_set1_epi32(x1);
+        for (int x = x0 & ~3; x < x1; x += 4) {
+            __m128i column = _mm_add_epi32(_mm_set1_epi32(x), _mm_set_epi32(3, 2, 1, 0));
+            __m128 inside = _mm_castsi128_ps(_mm_and_si128(_mm_cmpgt_epi32(column, first), _mm_cmplt_epi32(column, last)));
+            if (_mm_movemask_ps(_mm_and_ps(inside, _mm_cmplt_ps(_mm_load_ps(row + x), boxDepth)))) {
+                return true;
+            }
+        }
+#else
+        for (int x = x0; x < x1; ++x) {
+            if (row[x] < nearest) {
+                return true;
+            }
+        }
+#endif
+    }
+    return false;
+}
+
+void OcclusionBuffer::setupPolygons(const std::vector<const Occluder*> &occluders)
+{
+    m_polygons.clear();
+    for (std::vector<const Occluder*>::const_iterator it = occluders.cbegin(); it != occluders.cend(); ++it) {
+        // clip the quad against the near plane, which may add one more corner
+        glm::vec4 clip[4], polygon[5];
+        int count = 0;
+        for (int i = 0; i < 4; ++i) {
+            clip[i] = m_viewProjection * glm::vec4((*it)->corners[i], 1.0f);
+        }
+        for (int i = 0; i < 4; ++i) {
+            const glm::vec4 &a = clip[i], &b = clip[(i + 1) % 4];
+            float da = a.z + a.w, db = b.z + b.w;
+            if (da >= 0) {
+                polygon[count++] = a;
+            }
+            if ((da >= 0) != (db >= 0)) {
+                polygon[count++] = a + (b - a) * (da / (da - db));
+            }
+        }
+        if (count < 3) {
+            continue;
+        }
+
+        glm::vec3 screen[5];
+        for (int i = 0; i < count; ++i) {
+            float invW = 1.0f / MAX(polygon[i].w, 1e-6f);
+            screen[i] = glm::vec3((polygon[i].x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH,
+                                  (polygon[i].y * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+                                  invW);
+        }
+
+        // the whole polygon at once, split into triangles the pixels along the diagonal would be covered by neither.
+        // The depth plane is taken from the largest triangle of the fan, the others may be slivers.
+        float area = 0.0f, largest = 0.0f;
+        int apex = 1;
+        for (int i = 1; i + 1 < count; ++i) {
+            const glm::vec3 &v0 = screen[0], &v1 = screen[i], &v2 = screen[i + 1];
+            float triangle = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+            area += triangle;
+            if (fabsf(triangle) > fabsf(largest)) {
+                largest = triangle;
+                apex = i;
+            }
+        }
+        if (fabsf(largest) < 1e-6f) {
+            continue;
+        }
+        // walls are solid from both sides, so flip the edges of clockwise polygons instead of dropping them
+        const float orientation = area < 0 ? -1.0f : 1.0f;
+
+        Polygon p;
+        p.edgeCount = count;
+        float minX = screen[0].x, minY = screen[0].y, maxX = screen[0].x, maxY = screen[0].y;
+        for (int e = 0; e < count; ++e) {
+            const glm::vec3 &a = screen[e], &b = screen[(e + 1) % count];
+            p.edgeA[e] = (a.y - b.y) * orientation;
+            p.edgeB[e] = (b.x - a.x) * orientation;
+            // moved in by half a pixel along either axis, so that only the pixels lying inside as a whole pass
+            p.edgeC[e] = ((b.y - a.y) * a.x - (b.x - a.x) * a.y) * orientation - 0.5f * (fabsf(p.edgeA[e]) + fabsf(p.edgeB[e]));
+            minX = MIN(minX, a.x);
+            minY = MIN(minY, a.y);
+            maxX = MAX(maxX, a.x);
+            maxY = MAX(maxY, a.y);
+        }
+        const glm::vec3 &v0 = screen[0], &v1 = screen[apex], &v2 = screen[apex + 1];
+        p.depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / largest;
+        p.depthB = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / largest;
+        // the farthest corner of the pixel, rather than its center
+        p.depthC = v0.z - p.depthA * v0.x - p.depthB * v0.y - 0.5f * (fabsf(p.depthA) + fabsf(p.depthB));
+        p.minX = MAX((int)floorf(minX), 0);
+        p.minY = MAX((int)floorf(minY), 0);
+        p.maxX = MIN((int)ceilf(maxX), OCCLUSION_WIDTH);
+        p.maxY = MIN((int)ceilf(maxY), OCCLUSION_HEIGHT);
+        if (p.minX < p.maxX && p.minY < p.maxY) {
+            m_polygons.push_back(p);
+        }
+    }
+}
+
+void OcclusionBuffer::rasterizeBand(int firstRow, int lastRow)
+{
+    for (int y = firstRow; y < lastRow; ++y) {
+        float *row = m_depth + y * OCCLUSION_WIDTH;
+        for (int x = 0; x < OCCLUSION_WIDTH; ++x) {
+            row[x] = 0.0f;
+        }
+    }
+
+    for (std::vector<Polygon>::const_iterator p = m_polygons.cbegin(); p != m_polygons.cend(); ++p) {
+        int y0 = MAX(p->minY, firstRow), y1 = MIN(p->maxY, lastRow);
+        for (int y = y0; y < y1; ++y) {
+            float *row = m_depth + y * OCCLUSION_WIDTH;
+            const float py = y + 0.5f;
+#ifdef __SSE2__
+            // pixels outside the polygon bounds fail an edge test, so the start can be aligned down
+            const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            const __m128 zero = _mm_setzero_ps();
+            for (int x = p->minX & ~3; x < p->maxX; x += 4) {
+                __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int e = 0; e < p->edgeCount; ++e) {
+                    __m128 edge = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p->edgeA[e]), px), _mm_set1_ps(p->edgeB[e] * py + p->edgeC[e]));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+                }
+                __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p->depthA), px), _mm_set1_ps(p->depthB * py + p->depthC));
+                __m128 current = _mm_load_ps(row + x);
+                __m128 nearer = _mm_max_ps(current, depth);
+                _mm_store_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+            }
+#else
+            for (int x = p->minX; x < p->maxX; ++x) {
+                const float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < p->edgeCount; ++e) {
+                    inside = inside && p->edgeA[e] * px + p->edgeB[e] * py + p->edgeC[e] >= 0;
+                }
+                if (inside) {
+                    row[x] = MAX(row[x], p->depthA * px + p->depthB * py + p->depthC);
+                }
+            }
+#endif
+        }
+    }
+}
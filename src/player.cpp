@@ -10,10 +10,10 @@
 
 // Constructor with vectors
 Player::Player(bool *walls) :
+    m_walls(walls),
     Front(glm::vec3(0.0f, 0.0f, -1.0f)),
     MovementSpeed(SPEED),
-    MouseSensitivity(SENSITIVITY),
-    m_walls(walls)
+    MouseSensitivity(SENSITIVITY)
 {
     Position = glm::vec3(WALL_SIZE / 2.0f);
     if (!walls[1]) {
@@ -26,6 +26,23 @@ Player::Player(bool *walls) :
     WorldUp = glm::vec3(0.0f, 1.0f, 0.0f);
     Pitch = PITCH;
     updateViewVectors();
+    beginTick();
+}
+
+PlayerPose Player::pose() const
+{
+    PlayerPose pose = { Position, Yaw, Pitch };
+    return pose;
+}
+
+PlayerPose Player::previousPose() const
+{
+    return PreviousPose;
+}
+
+void Player::beginTick()
+{
+    PreviousPose = pose();
 }
 
 // Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
@@ -67,11 +84,22 @@ void Player::processRotation(float xoffset, float yoffset, GLboolean constrainPi
         if (Pitch < -89.0f)
             Pitch = -89.0f;
     }
+#else
+    (void)constrainPitch;
 #endif
     // Update Front, Right and Up Vectors using the updated Euler angles
     updateViewVectors();
 }
 
+void Player::setPose(const glm::vec3 &position, float yaw, float pitch)
+{
+    Position = position;
+    Yaw = yaw;
+    Pitch = pitch;
+    updateViewVectors();
+    beginTick();
+}
+
 glm::vec3 Player::validateMovement(glm::vec3 movementOffset)
 {
 #ifdef DEBUG
@@ -132,6 +160,27 @@ glm::vec3 Player::validateMovement(glm::vec3 movementOffset)
 #endif
 }
 
+glm::mat4 PlayerPose::getViewMatrix() const
+{
+    const glm::vec3 worldUp(0.0f, 1.0f, 0.0f);
+    glm::vec3 front(cos(glm::radians(yaw)) * cos(glm::radians(pitch)),
+                    sin(glm::radians(pitch)),
+                    sin(glm::radians(yaw)) * cos(glm::radians(pitch)));
+    glm::vec3 up = glm::normalize(glm::cross(glm::normalize(glm::cross(front, worldUp)), front));
+    return glm::lookAt(position, position + front, up);
+}
+
+PlayerPose PlayerPose::interpolate(const PlayerPose &next, float alpha) const
+{
+    PlayerPose pose = { glm::mix(position, next.position, alpha), glm::mix(yaw, next.yaw, alpha), glm::mix(pitch, next.pitch, alpha) };
+    return pose;
+}
+
+bool PlayerPose::operator==(const PlayerPose &other) const
+{
+    return position == other.position && yaw == other.yaw && pitch == other.pitch;
+}
+
 // Calculates the front vector from the Camera's (updated) Euler Angles
 void Player::updateViewVectors()
 {
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.h"
+#include "console.h"
+#include "common.h"
+
+#include <GL/glew.h>
+#include <string.h>
+
+#define PROFILER_CSV_PATH "./profile.csv"
+
+static float elapsedMs(const std::chrono::steady_clock::time_point &start);
+
+Profiler *Profiler::Instance()
+{
+    static Profiler instance;
+    return &instance;
+}
+
+Profiler::Profiler()
+    : m_enabled(false), m_gpuTiming(false), m_frame(0), m_hasQueries(false), m_lastCpuClock(clock()), m_cpuUsage(0.0f), m_historySize(0), m_historyNext(0), m_csv(NULL)
+{
+    memset(m_issued, 0, sizeof(m_issued));
+    memset(m_gpuMs, 0, sizeof(m_gpuMs));
+    for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+        m_latestGpuMs[pass] = -1.0f;
+    }
+    memset(&m_current, 0, sizeof(m_current));
+    for (int section = 0; section < CPU_SECTION_COUNT; ++section) {
+        m_cpuMs[section] = 0.0f;
+    }
+    m_frameStart = m_lastCsvWrite = m_lastCpuSample = std::chrono::steady_clock::now();
+    CONSOLE_DEBUG("Profiler [%p] created.", this);
+}
+
+Profiler::~Profiler()
+{
+    // the context is gone by the time the statics are destroyed, so the queries are left to it
+    if (m_csv) {
+        fclose(m_csv);
+    }
+    CONSOLE_DEBUG("Profiler [%p] destroyed.", this);
+}
+
+bool Profiler::isEnabled() const
+{
+    return m_enabled;
+}
+
+void Profiler::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    m_historySize = m_historyNext = 0;
+    m_lastCsvWrite = std::chrono::steady_clock::now();
+    memset(m_issued, 0, sizeof(m_issued));
+    CONSOLE_INFO("Profiler %s", enabled ? "enabled" : "disabled");
+}
+
+void Profiler::setGpuTimingEnabled(bool enabled)
+{
+    if (enabled != m_gpuTiming) {
+        m_gpuTiming = enabled;
+        memset(m_issued, 0, sizeof(m_issued));
+    }
+}
+
+float Profiler::latestGpuMs(GpuPass pass) const
+{
+    return m_latestGpuMs[pass];
+}
+
+void Profiler::beginFrame()
+{
+    m_frameStart = std::chrono::steady_clock::now();
+    memset(&m_current, 0, sizeof(m_current));
+    for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+        m_latestGpuMs[pass] = -1.0f;
+    }
+    if (!m_enabled && !m_gpuTiming) {
+        return;
+    }
+
+    if (!m_hasQueries) {
+        glGenQueries(2 * GPU_PASS_COUNT, m_queries[0]);
+        m_hasQueries = true;
+    }
+    // a result that is still not there is skipped rather than waited for
+    int set = m_frame % 2;
+    for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+        if (!m_issued[set][pass]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[set][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(m_queries[set][pass], GL_QUERY_RESULT, &nanoseconds);
+            m_gpuMs[pass] = nanoseconds / 1000000.0f;
+            m_latestGpuMs[pass] = m_gpuMs[pass];
+        }
+        m_issued[set][pass] = false;
+    }
+}
+
+void Profiler::endFrame()
+{
+    for (int section = 0; section < CPU_SECTION_COUNT; ++section) {
+        m_current.cpuMs[section] = m_cpuMs[section].exchange(0.0f);
+    }
+    // sampled while disabled as well, so that the figure is a current one as soon as the profiler is turned on
+    float sampleMs = elapsedMs(m_lastCpuSample);
+    if (sampleMs >= 1000.0f) {
+        clock_t cpuClock = clock();
+        // 100% is one core kept busy
+        m_cpuUsage = 100.0f * (cpuClock - m_lastCpuClock) / CLOCKS_PER_SEC / (sampleMs / 1000.0f);
+        m_lastCpuClock = cpuClock;
+        m_lastCpuSample = std::chrono::steady_clock::now();
+    }
+    if (!m_enabled) {
+        ++m_frame;
+        return;
+    }
+
+    m_current.frameMs = elapsedMs(m_frameStart);
+    memcpy(m_current.gpuMs, m_gpuMs, sizeof(m_gpuMs));
+    m_history[m_historyNext] = m_current;
+    m_historyNext = (m_historyNext + 1) % PROFILER_HISTORY;
+    m_historySize = MIN(m_historySize + 1, PROFILER_HISTORY);
+    ++m_frame;
+
+    if (elapsedMs(m_lastCsvWrite) >= 1000.0f) {
+        m_lastCsvWrite = std::chrono::steady_clock::now();
+        writeCsv();
+    }
+}
+
+void Profiler::beginGpu(GpuPass pass)
+{
+    if ((m_enabled || m_gpuTiming) && m_hasQueries) {
+        glBeginQuery(GL_TIME_ELAPSED, m_queries[m_frame % 2][pass]);
+    }
+}
+
+void Profiler::endGpu(GpuPass pass)
+{
+    if ((m_enabled || m_gpuTiming) && m_hasQueries) {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_issued[m_frame % 2][pass] = true;
+    }
+}
+
+void Profiler::beginCpu(CpuSection section)
+{
+    m_cpuStart[section] = std::chrono::steady_clock::now();
+}
+
+void Profiler::endCpu(CpuSection section)
+{
+    float elapsed = elapsedMs(m_cpuStart[section]);
+    float total = m_cpuMs[section].load();
+    while (!m_cpuMs[section].compare_exchange_weak(total, total + elapsed)) {
+    }
+}
+
+void Profiler::countDraws(unsigned int draws, unsigned int triangles)
+{
+    m_current.draws += draws;
+    m_current.triangles += triangles;
+}
+
+void Profiler::countStateChanges(unsigned int changes)
+{
+    m_current.stateChanges += changes;
+}
+
+std::vector<std::string> Profiler::report() const
+{
+    FrameStats stats = average();
+    char line[128];
+    std::vector<std::string> lines;
+
+    snprintf(line, sizeof(line), "FPS %.1f  FRAME %.2f MS", stats.frameMs > 0.0f ? 1000.0f / stats.frameMs : 0.0f, stats.frameMs);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "CPU UPDATE %.2f  DRAW %.2f  SWAP %.2f", stats.cpuMs[CPU_UPDATE], stats.cpuMs[CPU_DRAW], stats.cpuMs[CPU_SWAP]);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "GPU MAZE %.2f  MINIMAP %.2f  HUD %.2f", stats.gpuMs[GPU_MAZE], stats.gpuMs[GPU_MINIMAP], stats.gpuMs[GPU_HUD]);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "DRAWS %u  TRIS %u  STATES %u", stats.draws, stats.triangles, stats.stateChanges);
+    lines.push_back(line);
+    snprintf(line, sizeof(line), "PROCESS CPU %.1f%%", m_cpuUsage);
+    lines.push_back(line);
+    return lines;
+}
+
+Profiler::FrameStats Profiler::average() const
+{
+    FrameStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (m_historySize == 0) {
+        return stats;
+    }
+
+    for (unsigned int i = 0; i < m_historySize; ++i) {
+        const FrameStats &frame = m_history[i];
+        stats.frameMs += frame.frameMs;
+        for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+            stats.gpuMs[pass] += frame.gpuMs[pass];
+        }
+        for (int section = 0; section < CPU_SECTION_COUNT; ++section) {
+            stats.cpuMs[section] += frame.cpuMs[section];
+        }
+        stats.draws += frame.draws;
+        stats.triangles += frame.triangles;
+        stats.stateChanges += frame.stateChanges;
+    }
+    stats.frameMs /= m_historySize;
+    for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+        stats.gpuMs[pass] /= m_historySize;
+    }
+    for (int section = 0; section < CPU_SECTION_COUNT; ++section) {
+        stats.cpuMs[section] /= m_historySize;
+    }
+    stats.draws /= m_historySize;
+    stats.triangles /= m_historySize;
+    stats.stateChanges /= m_historySize;
+    return stats;
+}
+
+void Profiler::writeCsv()
+{
+    if (!m_csv) {
+        m_csv = fopen(PROFILER_CSV_PATH, "w");
+        if (!m_csv) {
+            CONSOLE_WARNING("Could not open %s", PROFILER_CSV_PATH);
+            return;
+        }
+        fprintf(m_csv, "frame,frame_ms,cpu_update_ms,cpu_draw_ms,cpu_swap_ms,gpu_maze_ms,gpu_minimap_ms,gpu_hud_ms,draws,triangles,state_changes,process_cpu_percent\n");
+    }
+
+    FrameStats stats = average();
+    fprintf(m_csv, "%lu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%u,%u,%u,%.1f\n", m_frame, stats.frameMs,
+            stats.cpuMs[CPU_UPDATE], stats.cpuMs[CPU_DRAW], stats.cpuMs[CPU_SWAP],
+            stats.gpuMs[GPU_MAZE], stats.gpuMs[GPU_MINIMAP], stats.gpuMs[GPU_HUD],
+            stats.draws, stats.triangles, stats.stateChanges, m_cpuUsage);
+    fflush(m_csv);
+}
+
+static float elapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
@@ -26,6 +26,7 @@
 
 #include "shader.h"
 #include "console.h"
+#include "glstate.h"
 
 #define USE_SHADER(useShader) if (useShader) this->use()
 
@@ -37,7 +38,7 @@ Shader::~Shader()
 
 void Shader::use()
 {
-    glUseProgram(this->ID);
+    gl::useProgram(this->ID);
 }
 
 void Shader::compile(const GLchar* vertexSource, const GLchar* fragmentSource)
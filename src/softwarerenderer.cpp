@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "softwarerenderer.h"
+#include "threadpool.h"
+#include "shader.h"
+#include "console.h"
+#include "common.h"
+#include "trace.h"
+#include "glstate.h"
+#include "stb_image.h"
+
+#include <GL/glew.h>
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define WALL_TEXTURE_PATH "./resources/textures/wall_diffuse.jpg"
+// columns handed to the thread pool at a time, enough to keep the scheduling cost down
+#define COLUMNS_PER_JOB 16
+#define AMBIENT_LIGHT 0.1f
+// the lighting is applied in fixed point, with one being this much
+#define LIGHT_ONE 128
+#define BACKGROUND 0xff000000u
+
+// Everything a column needs to know about the view it belongs to
+struct SoftwareRenderer::Camera {
+    glm::vec3 eye;
+    // the view direction and the one to its right, both level with the floor
+    glm::vec2 forward;
+    glm::vec2 right;
+    // the distance of the screen from the eye in pixels, which fits the vertical field of view in the view height
+    float focal;
+    // the row the horizon is on, counted from the top of the view, as far down as the player looks up
+    float horizon;
+    float far;
+    // for every row of the view, the distance along the view direction to where it meets the floor or the
+    // ceiling and the mip level the texture is read from there, as the same for every column
+    const float *rowDistances;
+    const int *rowLevels;
+    // the columns of the view in the framebuffer, and its rows counted from the top
+    int left;
+    int top;
+    int width;
+    int height;
+};
+
+static void loadWallTexture();
+static void fillWall(uint32_t *pixels, int first, int end, const SoftwareRenderer::Camera &camera, const uint32_t *texels, int sizeLog2,
+                     float t, float facing, float distance2);
+static void fillPlane(uint32_t *pixels, int first, int end, const SoftwareRenderer::Camera &camera, const glm::vec2 &direction, float height);
+static void hitBox(const glm::vec2 &origin, const glm::vec2 &inverseDirection, const glm::vec2 &low, const glm::vec2 &high, float *t, glm::vec2 *normal);
+static glm::vec2 wallTexCoord(const glm::vec3 &position, const glm::vec2 &normal);
+
+static Shader blitShader;
+
+// The mip chain of the wall texture, every level stored column by column from the bottom, so
+// that the texels a wall span reads lie one after the other
+static std::vector<std::vector<uint32_t> > wallLevels;
+static int wallSizeLog2;
+
+SoftwareRenderer::SoftwareRenderer(const bool *walls)
+    : m_cells(Maze::rayCells(walls)), m_width(0), m_height(0), m_texture(0), m_VAO(0), m_textureWidth(0), m_textureHeight(0)
+{
+    if (blitShader.id() == (GLuint)-1) {
+        const char *vertexShaderSource = "#version 330 core\n"
+            "out vec2 TexCoord;\n"
+            "void main()\n"
+            "{\n"
+            "  vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;\n"
+            "  TexCoord = position * 0.5 + 0.5;\n"
+            "  gl_Position = vec4(position, 0.0, 1.0);\n"
+            "}\0";
+        // the columns of the framebuffer are the rows of the texture, from the top of the view
+        const char *fragmentShaderSource = "#version 330 core\n"
+            "out vec4 FragColor;\n"
+            "in vec2 TexCoord;\n"
+            "uniform sampler2D frame;\n"
+            "void main()\n"
+            "{\n"
+            "  FragColor = texture(frame, vec2(1.0 - TexCoord.y, TexCoord.x));\n"
+            "}\0";
+        blitShader.compile(vertexShaderSource, fragmentShaderSource);
+        blitShader.use();
+        blitShader.setInteger("frame", 0);
+        loadWallTexture();
+    }
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenVertexArrays(1, &m_VAO);
+
+    CONSOLE_DEBUG("SoftwareRenderer [%p] created.", this);
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+    glDeleteTextures(1, &m_texture);
+    glDeleteVertexArrays(1, &m_VAO);
+    CONSOLE_DEBUG("SoftwareRenderer [%p] destroyed.", this);
+}
+
+void SoftwareRenderer::draw(const std::vector<Maze::View> &views)
+{
+    TRACE_ZONE("draw software view");
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != m_width || viewport[3] != m_height) {
+        m_width = viewport[2];
+        m_height = viewport[3];
+        m_columns.assign((size_t)m_width * m_height, BACKGROUND);
+    }
+
+    int viewCount = MIN((int)views.size(), MAX_PLAYERS);
+    Camera cameras[MAX_PLAYERS];
+    // every job is a run of columns of one view
+    std::vector<std::pair<int, int> > jobs;
+    for (int i = 0; i < viewCount; ++i) {
+        const Maze::View &view = views[i];
+        Camera &camera = cameras[i];
+        // the rows of the view matrix are the right, up and backward directions
+        glm::vec3 front = -glm::vec3(view.view[0][2], view.view[1][2], view.view[2][2]);
+        glm::vec2 level(front.x, front.z);
+        float levelLength = glm::length(level);
+        camera.eye = view.eye;
+        camera.forward = levelLength > 1e-6f ? level / levelLength : glm::vec2(1.0f, 0.0f);
+        camera.right = glm::vec2(-camera.forward.y, camera.forward.x);
+        camera.left = view.viewport[0] - viewport[0];
+        camera.width = view.viewport[2];
+        camera.height = view.viewport[3];
+        camera.top = m_height - (view.viewport[1] - viewport[1]) - camera.height;
+        glm::mat4 projection = Maze::perspective((float)camera.width / MAX(camera.height, 1));
+        camera.focal = camera.height * 0.5f * projection[1][1];
+        camera.horizon = camera.height * 0.5f + front.y / MAX(levelLength, 1e-6f) * camera.focal;
+        camera.far = projection[3][2] / (projection[2][2] + 1.0f);
+        prepareRows(i, &camera);
+        for (int column = 0; column < camera.width; column += COLUMNS_PER_JOB) {
+            jobs.push_back(std::make_pair(i, camera.left + column));
+        }
+    }
+
+    {
+        TRACE_ZONE("cast columns");
+        ThreadPool::Instance()->parallelFor(jobs.size(), [this, &jobs, &cameras](int job) {
+            const Camera &camera = cameras[jobs[job].first];
+            int end = MIN(jobs[job].second + COLUMNS_PER_JOB, camera.left + camera.width);
+            for (int column = jobs[job].second; column < end; ++column) {
+                renderColumn(camera, column);
+            }
+        });
+    }
+
+    // the texture is as wide as the framebuffer is high
+    glActiveTexture(GL_TEXTURE0);
+    gl::bindTexture(GL_TEXTURE_2D, m_texture);
+    if (m_textureWidth != m_height || m_textureHeight != m_width) {
+        m_textureWidth = m_height;
+        m_textureHeight = m_width;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_textureWidth, m_textureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, &m_columns[0]);
+    }
+    else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_textureWidth, m_textureHeight, GL_RGBA, GL_UNSIGNED_BYTE, &m_columns[0]);
+    }
+    blitShader.use();
+    gl::bindVertexArray(m_VAO);
+    gl::disable(GL_DEPTH_TEST);
+    gl::drawArrays(GL_TRIANGLES, 0, 3);
+    gl::enable(GL_DEPTH_TEST);
+    gl::bindVertexArray(0);
+}
+
+void SoftwareRenderer::renderColumn(const Camera &camera, int column)
+{
+    uint32_t *pixels = &m_columns[(size_t)column * m_height + camera.top];
+    glm::vec2 direction = camera.forward + camera.right * ((column - camera.left + 0.5f - camera.width * 0.5f) / camera.focal);
+    glm::vec2 normal;
+    float t = castRay(glm::vec2(camera.eye.x, camera.eye.z), direction, &normal);
+
+    // the rows whose centers lie above the horizon see the ceiling, unless a wall is in the way
+    int wallTop = MIN(MAX((int)ceilf(camera.horizon - 0.5f), 0), camera.height);
+    int wallBottom = wallTop;
+    if (t > 0.0f && t <= camera.far) {
+        wallTop = MIN(MAX((int)ceilf(camera.horizon - (WALL_SIZE - camera.eye.y) * camera.focal / t - 0.5f), 0), camera.height);
+        wallBottom = MIN(MAX((int)ceilf(camera.horizon + camera.eye.y * camera.focal / t - 0.5f), 0), camera.height);
+
+        // the wall is as detailed as its texels are tall on the screen
+        float texelsPerPixel = (1 << wallSizeLog2) / WALL_SIZE * t / camera.focal;
+        int level = MIN(MAX((int)floorf(log2f(MAX(texelsPerPixel, 1.0f))), 0), wallSizeLog2);
+        int sizeLog2 = wallSizeLog2 - level;
+        glm::vec3 position = camera.eye + glm::vec3(direction.x, 0.0f, direction.y) * t;
+        int u = (int)floorf(wallTexCoord(position, normal).x * (1 << sizeLog2)) & ((1 << sizeLog2) - 1);
+        float planar = glm::length(direction) * t;
+        fillWall(pixels, wallTop, wallBottom, camera, &wallLevels[level][(size_t)u << sizeLog2], sizeLog2,
+                 t, -glm::dot(normal, direction) * t, planar * planar);
+    }
+    fillPlane(pixels, 0, wallTop, camera, direction, WALL_SIZE - camera.eye.y);
+    fillPlane(pixels, wallBottom, camera.height, camera, direction, camera.eye.y);
+}
+
+void SoftwareRenderer::prepareRows(int viewIndex, Camera *camera)
+{
+    // padded so that the rows are read four at a time past the last one
+    std::vector<float> &distances = m_rowDistances[viewIndex];
+    std::vector<int> &levels = m_rowLevels[viewIndex];
+    distances.resize(camera->height + 3);
+    levels.resize(camera->height + 3);
+    const float texelsPerUnit = MAZE_WIDTH / (MAZE_WIDTH * (WALL_SIZE + WALL_THICKNESS) - WALL_THICKNESS) * (1 << wallSizeLog2);
+    for (int row = 0; row < camera->height + 3; ++row) {
+        float below = row + 0.5f - camera->horizon;
+        float height = below > 0.0f ? camera->eye.y : WALL_SIZE - camera->eye.y;
+        // a row hits the plane at the height of the eye over it times the focal length over its distance from the horizon
+        float t = below != 0.0f ? height * camera->focal / fabsf(below) : FLT_MAX;
+        distances[row] = t <= camera->far ? t : FLT_MAX;
+        // the texels between the pixel and the ones next to it and below it, in the middle of the view
+        float footprint = MAX(1.0f / camera->focal, t / (height * camera->focal)) * MIN(t, camera->far) * texelsPerUnit;
+        levels[row] = MIN(MAX((int)floorf(log2f(MAX(footprint, 1.0f))), 0), wallSizeLog2);
+    }
+    camera->rowDistances = &distances[0];
+    camera->rowLevels = &levels[0];
+}
+
+float SoftwareRenderer::castRay(const glm::vec2 &origin, const glm::vec2 &direction, glm::vec2 *normal) const
+{
+    const float pitch = WALL_SIZE + WALL_THICKNESS;
+    // the same walk as the ray marcher, cell by cell, so the first cell with a hit holds the nearest one
+    glm::vec2 planar(fabsf(direction.x) < 1e-6f ? 1e-6f : direction.x, fabsf(direction.y) < 1e-6f ? 1e-6f : direction.y);
+    glm::vec2 inverseDirection = 1.0f / planar;
+    int stepX = planar.x > 0.0f ? 1 : -1, stepY = planar.y > 0.0f ? 1 : -1;
+    int cellX = (int)floorf((origin.x + WALL_THICKNESS) / pitch), cellY = (int)floorf((origin.y + WALL_THICKNESS) / pitch);
+    glm::vec2 tNext(((cellX + (stepX > 0)) * pitch - WALL_THICKNESS - origin.x) * inverseDirection.x,
+                    ((cellY + (stepY > 0)) * pitch - WALL_THICKNESS - origin.y) * inverseDirection.y);
+    glm::vec2 tDelta = glm::abs(pitch * inverseDirection);
+    for (int i = 0; i < RAY_CELLS_X + RAY_CELLS_Y; ++i) {
+        if (cellX < 0 || cellY < 0 || cellX >= RAY_CELLS_X || cellY >= RAY_CELLS_Y) {
+            break;
+        }
+        GLuint bits = m_cells[cellY * RAY_CELLS_X + cellX];
+        glm::vec2 corner = glm::vec2(cellX, cellY) * pitch - WALL_THICKNESS;
+        float t = FLT_MAX;
+        if (bits & RAY_LEFT_WALL) {
+            hitBox(origin, inverseDirection, corner + glm::vec2(0.0f, WALL_THICKNESS), corner + glm::vec2(WALL_THICKNESS, pitch), &t, normal);
+        }
+        if (bits & RAY_TOP_WALL) {
+            hitBox(origin, inverseDirection, corner + glm::vec2(WALL_THICKNESS, 0.0f), corner + glm::vec2(pitch, WALL_THICKNESS), &t, normal);
+        }
+        if (bits & RAY_CORNER) {
+            hitBox(origin, inverseDirection, corner, corner + WALL_THICKNESS, &t, normal);
+        }
+        if (t < FLT_MAX) {
+            return t;
+        }
+        if (tNext.x < tNext.y) {
+            tNext.x += tDelta.x;
+            cellX += stepX;
+        }
+        else {
+            tNext.y += tDelta.y;
+            cellY += stepY;
+        }
+    }
+    return -1.0f;
+}
+
+static void loadWallTexture()
+{
+    TRACE_ZONE("decode software texture");
+    stbi_set_flip_vertically_on_load(true);
+    int width, height, channels;
+    unsigned char *data = stbi_load(WALL_TEXTURE_PATH, &width, &height, &channels, 4);
+    // the texel lookups wrap with a mask, so only square, power of two textures are taken
+    wallSizeLog2 = 0;
+    while (data && (1 << (wallSizeLog2 + 1)) <= width) {
+        ++wallSizeLog2;
+    }
+    int size = 1 << wallSizeLog2;
+    if (!data || width != size || height != size) {
+        CONSOLE_ERROR("%s is not a square power of two texture, the software renderer draws it grey", WALL_TEXTURE_PATH);
+        stbi_image_free(data);
+        wallSizeLog2 = 0;
+        wallLevels.assign(1, std::vector<uint32_t>(1, 0xff808080u));
+        return;
+    }
+
+    wallLevels.assign(wallSizeLog2 + 1, std::vector<uint32_t>());
+    std::vector<uint32_t> &base = wallLevels[0];
+    base.resize((size_t)size * size);
+    for (int v = 0; v < size; ++v) {
+        for (int u = 0; u < size; ++u) {
+            memcpy(&base[(size_t)u * size + v], &data[((size_t)v * size + u) * 4], 4);
+        }
+    }
+    stbi_image_free(data);
+
+    // every level is the box filtered one before it
+    for (int level = 1; level <= wallSizeLog2; ++level) {
+        const std::vector<uint32_t> &previous = wallLevels[level - 1];
+        std::vector<uint32_t> &current = wallLevels[level];
+        int previousSize = size >> (level - 1), currentSize = size >> level;
+        current.resize((size_t)currentSize * currentSize);
+        for (int u = 0; u < currentSize; ++u) {
+            for (int v = 0; v < currentSize; ++v) {
+                const uint32_t texels[4] = {
+                    previous[(size_t)(u * 2) * previousSize + v * 2], previous[(size_t)(u * 2) * previousSize + v * 2 + 1],
+                    previous[(size_t)(u * 2 + 1) * previousSize + v * 2], previous[(size_t)(u * 2 + 1) * previousSize + v * 2 + 1]
+                };
+                uint32_t texel = 0;
+                for (int channel = 0; channel < 32; channel += 8) {
+                    uint32_t sum = 2;
+                    for (int k = 0; k < 4; ++k) {
+                        sum += (texels[k] >> channel) & 0xff;
+                    }
+                    texel |= (sum / 4) << channel;
+                }
+                current[(size_t)u * currentSize + v] = texel;
+            }
+        }
+    }
+    CONSOLE_DEBUG("Software renderer texture: %dx%d, %d levels", size, size, wallSizeLog2 + 1);
+}
+
+#ifdef __SSE2__
+// Scales four RGBA texels by their lighting in fixed point, saturating at white
+static inline __m128i shadeTexels(__m128i texels, __m128i light)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i light16 = _mm_packs_epi32(light, light);
+    __m128i pairs = _mm_unpacklo_epi16(light16, light16);
+    __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(texels, zero), _mm_unpacklo_epi32(pairs, pairs));
+    __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(texels, zero), _mm_unpackhi_epi32(pairs, pairs));
+    __m128i shaded = _mm_packus_epi16(_mm_srli_epi16(low, 7), _mm_srli_epi16(high, 7));
+    return _mm_or_si128(shaded, _mm_set1_epi32((int)BACKGROUND));
+}
+
+// Stores the first count of the four pixels
+static inline void storePixels(uint32_t *pixels, __m128i values, int count)
+{
+    if (count >= 4) {
+        _mm_storeu_si128((__m128i *)pixels, values);
+        return;
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, values);
+    memcpy(pixels, lanes, sizeof(uint32_t) * count);
+}
+#else
+static inline uint32_t shadeTexel(uint32_t texel, int light)
+{
+    uint32_t shaded = BACKGROUND;
+    for (int channel = 0; channel < 24; channel += 8) {
+        shaded |= (uint32_t)MIN((int)((texel >> channel) & 0xff) * light >> 7, 255) << channel;
+    }
+    return shaded;
+}
+#endif
+
+static void fillWall(uint32_t *pixels, int first, int end, const SoftwareRenderer::Camera &camera, const uint32_t *texels, int sizeLog2,
+                     float t, float facing, float distance2)
+{
+    // a row is lower than the eye by its distance from the horizon times this
+    float drop = t / camera.focal;
+    float texelsPerUnit = (1 << sizeLog2) / WALL_SIZE;
+    int mask = (1 << sizeLog2) - 1;
+#ifdef __SSE2__
+    const __m128 step = _mm_set1_ps(4.0f * drop);
+    const __m128 eyeTexel = _mm_set1_ps(camera.eye.y * texelsPerUnit);
+    const __m128 texelsPerUnit4 = _mm_set1_ps(texelsPerUnit);
+    const __m128 facing4 = _mm_set1_ps(facing);
+    const __m128 distance4 = _mm_set1_ps(distance2);
+    const __m128 ambient = _mm_set1_ps(AMBIENT_LIGHT * LIGHT_ONE);
+    const __m128 one = _mm_set1_ps(LIGHT_ONE);
+    const __m128 saturated = _mm_set1_ps(255.0f);
+    const __m128i mask4 = _mm_set1_epi32(mask);
+    __m128 below = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(first + 0.5f - camera.horizon), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)), _mm_set1_ps(drop));
+    for (int row = first; row < end; row += 4) {
+        // the texture is stored from the bottom up, so the rows count up with the height of the point
+        __m128i texelRows = _mm_and_si128(_mm_cvttps_epi32(_mm_sub_ps(eyeTexel, _mm_mul_ps(below, texelsPerUnit4))), mask4);
+        int rows[4];
+        _mm_storeu_si128((__m128i *)rows, texelRows);
+        __m128i colors = _mm_setr_epi32(texels[rows[0]], texels[rows[1]], texels[rows[2]], texels[rows[3]]);
+        // the wall faces the player light by the level part of the way to the eye over the whole way
+        __m128 lambert = _mm_mul_ps(facing4, _mm_rsqrt_ps(_mm_add_ps(distance4, _mm_mul_ps(below, below))));
+        __m128 light = _mm_min_ps(_mm_add_ps(ambient, _mm_mul_ps(lambert, one)), saturated);
+        storePixels(pixels + row, shadeTexels(colors, _mm_cvtps_epi32(light)), end - row);
+        below = _mm_add_ps(below, step);
+    }
+#else
+    for (int row = first; row < end; ++row) {
+        float below = (row + 0.5f - camera.horizon) * drop;
+        int texelRow = (int)((camera.eye.y - below) * texelsPerUnit) & mask;
+        float light = AMBIENT_LIGHT + facing / sqrtf(distance2 + below * below);
+        pixels[row] = shadeTexel(texels[texelRow], (int)(MIN(light * LIGHT_ONE, 255.0f) + 0.5f));
+    }
+#endif
+}
+
+static void fillPlane(uint32_t *pixels, int first, int end, const SoftwareRenderer::Camera &camera, const glm::vec2 &direction, float height)
+{
+    // the floor and the ceiling repeat the texture once per cell over the inside of the maze
+    const glm::vec2 inside = glm::vec2(MAZE_WIDTH, MAZE_HEIGHT) * (WALL_SIZE + WALL_THICKNESS) - WALL_THICKNESS;
+    const glm::vec2 repeats = glm::vec2(MAZE_WIDTH, MAZE_HEIGHT) / inside;
+    float length2 = glm::dot(direction, direction);
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 eyeX = _mm_set1_ps(camera.eye.x), eyeZ = _mm_set1_ps(camera.eye.z);
+    const __m128 directionX = _mm_set1_ps(direction.x), directionZ = _mm_set1_ps(direction.y);
+    const __m128 insideX = _mm_set1_ps(inside.x), insideZ = _mm_set1_ps(inside.y);
+    const __m128 length4 = _mm_set1_ps(length2);
+    const __m128 height4 = _mm_set1_ps(height), height2 = _mm_set1_ps(height * height);
+    const __m128 ambient = _mm_set1_ps(AMBIENT_LIGHT * LIGHT_ONE);
+    const __m128 one = _mm_set1_ps(LIGHT_ONE);
+    const __m128 saturated = _mm_set1_ps(255.0f);
+    const __m128 far = _mm_set1_ps(camera.far);
+    const __m128i background = _mm_set1_epi32((int)BACKGROUND);
+    for (int row = first; row < end; row += 4) {
+        __m128 t = _mm_loadu_ps(camera.rowDistances + row);
+        // the four rows are read from the level of the first one
+        int sizeLog2 = wallSizeLog2 - camera.rowLevels[row];
+        const uint32_t *texels = &wallLevels[camera.rowLevels[row]][0];
+        __m128 size = _mm_set1_ps((float)(1 << sizeLog2));
+        __m128i levelMask = _mm_set1_epi32((1 << sizeLog2) - 1);
+
+        __m128 x = _mm_add_ps(eyeX, _mm_mul_ps(directionX, t));
+        __m128 z = _mm_add_ps(eyeZ, _mm_mul_ps(directionZ, t));
+        __m128 visible = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmple_ps(x, insideX)),
+                                    _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, insideZ)), _mm_cmple_ps(t, far)));
+        __m128i u = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(x, _mm_set1_ps(repeats.x)), size)), levelMask);
+        __m128i v = _mm_and_si128(_mm_cvttps_epi32(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(insideZ, z), _mm_set1_ps(repeats.y)), size)), levelMask);
+        __m128i index = _mm_or_si128(_mm_sll_epi32(u, _mm_cvtsi32_si128(sizeLog2)), v);
+        int indices[4];
+        _mm_storeu_si128((__m128i *)indices, index);
+        __m128i colors = _mm_setr_epi32(texels[indices[0]], texels[indices[1]], texels[indices[2]], texels[indices[3]]);
+        // the plane faces the player light by the height of the eye over the whole way
+        __m128 lambert = _mm_mul_ps(height4, _mm_rsqrt_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(t, t), length4), height2)));
+        __m128 light = _mm_min_ps(_mm_add_ps(ambient, _mm_mul_ps(lambert, one)), saturated);
+        __m128i shaded = shadeTexels(colors, _mm_cvtps_epi32(light));
+        __m128i keep = _mm_castps_si128(visible);
+        storePixels(pixels + row, _mm_or_si128(_mm_and_si128(keep, shaded), _mm_andnot_si128(keep, background)), end - row);
+    }
+#else
+    for (int row = first; row < end; ++row) {
+        float t = camera.rowDistances[row];
+        glm::vec2 point = glm::vec2(camera.eye.x, camera.eye.z) + direction * t;
+        if (t > camera.far || point.x < 0.0f || point.y < 0.0f || point.x > inside.x || point.y > inside.y) {
+            pixels[row] = BACKGROUND;
+            continue;
+        }
+        int sizeLog2 = wallSizeLog2 - camera.rowLevels[row], levelMask = (1 << sizeLog2) - 1;
+        int u = (int)(point.x * repeats.x * (1 << sizeLog2)) & levelMask;
+        int v = (int)((inside.y - point.y) * repeats.y * (1 << sizeLog2)) & levelMask;
+        float light = AMBIENT_LIGHT + height / sqrtf(t * t * length2 + height * height);
+        pixels[row] = shadeTexel(wallLevels[camera.rowLevels[row]][((size_t)u << sizeLog2) + v], (int)(MIN(light * LIGHT_ONE, 255.0f) + 0.5f));
+    }
+#endif
+}
+
+static void hitBox(const glm::vec2 &origin, const glm::vec2 &inverseDirection, const glm::vec2 &low, const glm::vec2 &high, float *t, glm::vec2 *normal)
+{
+    glm::vec2 t0 = (low - origin) * inverseDirection;
+    glm::vec2 t1 = (high - origin) * inverseDirection;
+    glm::vec2 near = glm::min(t0, t1);
+    glm::vec2 far = glm::max(t0, t1);
+    float enter = MAX(near.x, near.y);
+    if (enter <= MIN(far.x, far.y) && enter >= 0.0f && enter < *t) {
+        *t = enter;
+        *normal = near.x > near.y ? glm::vec2(inverseDirection.x > 0.0f ? -1.0f : 1.0f, 0.0f) : glm::vec2(0.0f, inverseDirection.y > 0.0f ? -1.0f : 1.0f);
+    }
+}
+
+static glm::vec2 wallTexCoord(const glm::vec3 &position, const glm::vec2 &normal)
+{
+    // the same as the ray marcher, the outer walls are stretched over a whole number of repeats
+    const glm::vec2 inside = glm::vec2(MAZE_WIDTH, MAZE_HEIGHT) * (WALL_SIZE + WALL_THICKNESS) - WALL_THICKNESS;
+    if (normal.x != 0.0f) {
+        if (position.x < WALL_THICKNESS) {
+            return glm::vec2((inside.y - position.z) / inside.y * MAZE_HEIGHT, position.y / WALL_SIZE);
+        }
+        if (position.x > inside.x - WALL_THICKNESS) {
+            return glm::vec2((inside.y - WALL_SIZE - position.z) / (inside.y - WALL_SIZE) * MAZE_HEIGHT, position.y / WALL_SIZE);
+        }
+        return glm::vec2(position.z, position.y) / WALL_SIZE;
+    }
+    if (position.z < WALL_THICKNESS || position.z > inside.y - WALL_THICKNESS) {
+        return glm::vec2(position.x / inside.x * MAZE_WIDTH, position.y / WALL_SIZE);
+    }
+    return glm::vec2(position.x, position.y) / WALL_SIZE;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texture.h"
+#include "ktx.h"
+#include "console.h"
+#include "trace.h"
+
+#define STB_IMAGE_IMPLEMENTATION // nessesary to use stb_image.h
+#include "stb_image.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct KtxImage
+{
+    KtxHeader header;
+    std::vector<std::vector<unsigned char> > levels;
+};
+
+static bool loadKtx(const std::string &path, KtxImage &image);
+static bool isKtxFormatSupported(const KtxHeader &header);
+static bool uploadKtxLayers(const char *const *texturePaths, int count);
+static void uploadImageLayers(const char *const *texturePaths, int count);
+
+unsigned int makeTextureArray(const char *const *texturePaths, int count)
+{
+    TRACE_ZONE("load textures");
+    // load and create a texture array, one layer per image
+    // -----------------------------------------------------
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture); // all upcoming GL_TEXTURE_2D_ARRAY operations now have effect on this texture object
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (!uploadKtxLayers(texturePaths, count)) {
+        uploadImageLayers(texturePaths, count);
+    }
+    return texture;
+}
+
+static bool uploadKtxLayers(const char *const *texturePaths, int count)
+{
+    std::vector<KtxImage> images(count);
+    for (int i = 0; i < count; ++i) {
+        std::string path(texturePaths[i]);
+        std::string::size_type extension = path.rfind('.');
+        if (extension != std::string::npos && extension > path.rfind('/')) {
+            path.erase(extension);
+        }
+        path += ".ktx";
+
+        if (!loadKtx(path, images[i])) {
+            return false;
+        }
+        const KtxHeader &first = images[0].header, &header = images[i].header;
+        if (header.glInternalFormat != first.glInternalFormat || header.glFormat != first.glFormat || header.glType != first.glType ||
+            header.pixelWidth != first.pixelWidth || header.pixelHeight != first.pixelHeight || images[i].levels.size() != images[0].levels.size()) {
+            CONSOLE_WARNING("%s does not match the format of the other layers", path.c_str());
+            return false;
+        }
+        // a level may be empty in the file, but there would be nothing to upload for it
+        for (std::vector<std::vector<unsigned char> >::const_iterator level = images[i].levels.cbegin(); level != images[i].levels.cend(); ++level) {
+            if (level->empty()) {
+                CONSOLE_WARNING("%s has an empty mip level", path.c_str());
+                return false;
+            }
+        }
+    }
+    if (!isKtxFormatSupported(images[0].header)) {
+        CONSOLE_WARNING("Texture format 0x%x is not supported", images[0].header.glInternalFormat);
+        return false;
+    }
+
+    const KtxHeader &header = images[0].header;
+    std::vector<unsigned char> layers;
+    for (std::vector<std::vector<unsigned char> >::size_type level = 0; level < images[0].levels.size(); ++level) {
+        GLsizei width = header.pixelWidth >> level > 0 ? header.pixelWidth >> level : 1;
+        GLsizei height = header.pixelHeight >> level > 0 ? header.pixelHeight >> level : 1;
+        layers.clear();
+        for (int i = 0; i < count; ++i) {
+            layers.insert(layers.end(), images[i].levels[level].cbegin(), images[i].levels[level].cend());
+        }
+        if (header.glType == 0) {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, header.glInternalFormat, width, height, count, 0, layers.size(), &layers[0]);
+        }
+        else {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, header.glInternalFormat, width, height, count, 0, header.glFormat, header.glType, &layers[0]);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, images[0].levels.size() - 1);
+
+    CONSOLE_INFO("Uploaded %d prebuilt layers of %ux%u with %lu levels", count, header.pixelWidth, header.pixelHeight, images[0].levels.size());
+    return true;
+}
+
+static void uploadImageLayers(const char *const *texturePaths, int count)
+{
+    // load the images, all layers must share the size of the first one
+    int width = 0, height = 0;
+
+    stbi_set_flip_vertically_on_load(true);
+    for (int i = 0; i < count; ++i) {
+        int w, h, nrChannels;
+        unsigned char *data = stbi_load(texturePaths[i], &w, &h, &nrChannels, 3);
+        if (!data) {
+            CONSOLE_ERROR("Failed to load texture %s", texturePaths[i]);
+            continue;
+        }
+        if (width == 0) {
+            width = w;
+            height = h;
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, width, height, count, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        }
+        if (w == width && h == height) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, w, h, 1, GL_RGB, GL_UNSIGNED_BYTE, data);
+        }
+        else {
+            CONSOLE_ERROR("Texture %s is %dx%d, expected %dx%d", texturePaths[i], w, h, width, height);
+        }
+        stbi_image_free(data);
+    }
+    if (width > 0) {
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+}
+
+static bool loadKtx(const std::string &path, KtxImage &image)
+{
+    static const uint8_t identifier[12] = KTX_IDENTIFIER;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    // the sizes in the file are checked against its length, so that a corrupt one is refused rather than allocated for
+    long fileSize = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        fileSize = ftell(file);
+    }
+    rewind(file);
+
+    KtxHeader &header = image.header;
+    bool ok = fileSize >= 0 && fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.identifier, identifier, sizeof(identifier)) == 0 &&
+              header.endianness == KTX_ENDIANNESS &&
+              header.pixelWidth > 0 && header.pixelDepth == 0 && header.numberOfArrayElements == 0 && header.numberOfFaces == 1 &&
+              (unsigned long)header.bytesOfKeyValueData <= (unsigned long)(fileSize - ftell(file)) &&
+              fseek(file, header.bytesOfKeyValueData, SEEK_CUR) == 0;
+
+    // a full mip chain goes down to 1x1 and no further
+    uint32_t maxLevels = 1;
+    for (uint32_t size = header.pixelWidth > header.pixelHeight ? header.pixelWidth : header.pixelHeight; ok && size > 1; size >>= 1) {
+        ++maxLevels;
+    }
+    ok = ok && header.numberOfMipmapLevels > 0 && header.numberOfMipmapLevels <= maxLevels;
+
+    image.levels.resize(ok ? header.numberOfMipmapLevels : 0);
+    for (std::vector<std::vector<unsigned char> >::iterator level = image.levels.begin(); ok && level != image.levels.end(); ++level) {
+        uint32_t imageSize;
+        ok = fread(&imageSize, sizeof(imageSize), 1, file) == 1 && (unsigned long)imageSize <= (unsigned long)(fileSize - ftell(file));
+        if (ok && imageSize > 0) {
+            level->resize(imageSize);
+            // every level is padded to a multiple of 4 bytes
+            ok = fread(&(*level)[0], 1, imageSize, file) == imageSize && fseek(file, 3 - (imageSize + 3) % 4, SEEK_CUR) == 0;
+        }
+    }
+    fclose(file);
+
+    if (!ok) {
+        CONSOLE_ERROR("%s is not a valid 2D KTX texture", path.c_str());
+    }
+    return ok;
+}
+
+static bool isKtxFormatSupported(const KtxHeader &header)
+{
+    if (header.glType != 0) {
+        return header.glType == GL_UNSIGNED_BYTE && header.glTypeSize == 1;
+    }
+    switch (header.glInternalFormat) {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            return GLEW_EXT_texture_compression_s3tc;
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_RG_RGTC2:
+            return true;
+        default:
+            return false;
+    }
+}
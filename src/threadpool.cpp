@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpool.h"
+#include "console.h"
+#include "common.h"
+#include "trace.h"
+
+#include <atomic>
+#include <memory>
+
+// Shared between the caller of parallelFor and the workers that help it. It is reference counted,
+// because a worker may only get to its task after the caller has already finished every job.
+struct ParallelForState
+{
+    std::function<void(int)> job;
+    int count;
+    std::atomic<int> next;
+    std::atomic<int> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+
+    void run()
+    {
+        for (int i = next++; i < count; i = next++) {
+            job(i);
+            if (--remaining == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+};
+
+ThreadPool *ThreadPool::Instance()
+{
+    static ThreadPool instance;
+    return &instance;
+}
+
+ThreadPool::ThreadPool()
+    : m_stopping(false)
+{
+    // keep at least one worker around, so that submitted tasks run even on a single core
+    unsigned int threads = MAX(std::thread::hardware_concurrency(), 2u);
+    for (unsigned int i = 1; i < threads; ++i) {
+        m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+    CONSOLE_DEBUG("ThreadPool [%p] created with %lu workers.", this, m_workers.size());
+}
+
+ThreadPool::~ThreadPool()
+{
+    // the callers of parallelFor run the jobs their helpers leave, so only the background tasks are lost
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        m_tasks.clear();
+    }
+    m_condition.notify_all();
+    for (std::vector<std::thread>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+        it->join();
+    }
+    CONSOLE_DEBUG("ThreadPool [%p] destroyed.", this);
+}
+
+unsigned int ThreadPool::size() const
+{
+    return m_workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &job)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->job = job;
+    state->count = count;
+    state->next = 0;
+    state->remaining = count;
+
+    int helpers = MIN(count - 1, (int)m_workers.size());
+    if (helpers > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (int i = 0; i < helpers; ++i) {
+            m_tasks.push_back([state]() { state->run(); });
+        }
+    }
+    m_condition.notify_all();
+
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state]() { return state->remaining == 0; });
+}
+
+void ThreadPool::submit(const std::function<void()> &task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(task);
+    }
+    m_condition.notify_one();
+}
+
+const std::atomic<bool> &ThreadPool::stopping() const
+{
+    return m_stopping;
+}
+
+void ThreadPool::workerLoop()
+{
+    TRACE_THREAD_NAME("worker");
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_stopping && m_tasks.empty()) {
+                return;
+            }
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "console.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+
+struct TraceEvent
+{
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+// Written by its own thread only. head counts every zone ever recorded, the reader
+// takes the last TRACE_RING_SIZE of them.
+struct TraceRing
+{
+    int thread;
+    const char *name;
+    std::atomic<unsigned long> head;
+    TraceEvent events[TRACE_RING_SIZE];
+};
+
+// the rings outlive their threads, so that the zones of finished threads are dumped as well
+static std::mutex ringsMutex;
+static std::vector<TraceRing*> rings;
+static const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+static TraceRing *threadRing()
+{
+    static thread_local TraceRing *ring = NULL;
+    if (!ring) {
+        ring = new TraceRing();
+        ring->name = NULL;
+        ring->head = 0;
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        ring->thread = rings.size();
+        rings.push_back(ring);
+    }
+    return ring;
+}
+
+void traceRecord(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    TraceRing *ring = threadRing();
+    unsigned long head = ring->head.load(std::memory_order_relaxed);
+    TraceEvent &event = ring->events[head % TRACE_RING_SIZE];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void traceThreadName(const char *name)
+{
+    threadRing()->name = name;
+}
+
+void traceDump(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        CONSOLE_WARNING("Could not open %s", path);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (std::vector<TraceRing*>::const_iterator it = rings.cbegin(); it != rings.cend(); ++it) {
+        const TraceRing *ring = *it;
+        if (ring->name) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", ring->thread, ring->name);
+            first = false;
+        }
+        // zones a thread records while the dump runs may tear the oldest entries, which is fine for a timeline
+        unsigned long head = ring->head.load(std::memory_order_acquire);
+        for (unsigned long i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0; i < head; ++i) {
+            const TraceEvent &event = ring->events[i % TRACE_RING_SIZE];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", event.name, ring->thread,
+                    std::chrono::duration<double, std::micro>(event.start - traceEpoch).count(),
+                    std::chrono::duration<double, std::micro>(event.end - event.start).count());
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    CONSOLE_INFO("Trace written to %s", path);
+}
+
+#endif
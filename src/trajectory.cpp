@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trajectory.h"
+
+#include <math.h>
+#include <string.h>
+
+// the flag byte of a sample, bits 0 to 3 mark the components with a step of their own
+#define SAMPLE_REPEAT 0x10
+
+static void putVarint(std::vector<uint8_t> *bytes, int32_t value);
+static int32_t getVarint(const uint8_t **bytes);
+
+Trajectory::Trajectory()
+    : m_size(0)
+{
+    memset(m_last, 0, sizeof(m_last));
+    memset(m_delta, 0, sizeof(m_delta));
+}
+
+void Trajectory::record(const PlayerPose &pose)
+{
+    // the first sample is a step away from the origin
+    int32_t quantized[4] = {
+        (int32_t)lroundf(pose.position.x * TRAJECTORY_POSITION_STEPS),
+        (int32_t)lroundf(pose.position.y * TRAJECTORY_POSITION_STEPS),
+        (int32_t)lroundf(pose.position.z * TRAJECTORY_POSITION_STEPS),
+        (int32_t)lroundf(pose.yaw * TRAJECTORY_YAW_STEPS)
+    };
+    int32_t delta[4];
+    bool repeat = m_size > 0;
+    for (int i = 0; i < 4; ++i) {
+        delta[i] = quantized[i] - m_last[i];
+        repeat = repeat && delta[i] == m_delta[i];
+    }
+    ++m_size;
+    memcpy(m_last, quantized, sizeof(m_last));
+    if (repeat) {
+        m_bytes.push_back(SAMPLE_REPEAT);
+        return;
+    }
+
+    uint8_t flags = 0;
+    for (int i = 0; i < 4; ++i) {
+        flags |= delta[i] != 0 ? 1 << i : 0;
+    }
+    m_bytes.push_back(flags);
+    for (int i = 0; i < 4; ++i) {
+        if (delta[i] != 0) {
+            putVarint(&m_bytes, delta[i]);
+        }
+    }
+    memcpy(m_delta, delta, sizeof(m_delta));
+}
+
+int Trajectory::size() const
+{
+    return m_size;
+}
+
+size_t Trajectory::byteSize() const
+{
+    return m_bytes.size();
+}
+
+void Trajectory::decode(std::vector<glm::vec4> *samples) const
+{
+    int32_t value[4] = { 0, 0, 0, 0 };
+    int32_t delta[4] = { 0, 0, 0, 0 };
+    const uint8_t *bytes = m_bytes.empty() ? NULL : &m_bytes[0];
+    samples->reserve(samples->size() + m_size);
+    for (int sample = 0; sample < m_size; ++sample) {
+        uint8_t flags = *bytes++;
+        if (!(flags & SAMPLE_REPEAT)) {
+            for (int i = 0; i < 4; ++i) {
+                delta[i] = flags & (1 << i) ? getVarint(&bytes) : 0;
+            }
+        }
+        for (int i = 0; i < 4; ++i) {
+            value[i] += delta[i];
+        }
+        samples->push_back(glm::vec4(glm::vec3(value[0], value[1], value[2]) / (float)TRAJECTORY_POSITION_STEPS,
+                                     glm::radians((float)value[3] / TRAJECTORY_YAW_STEPS)));
+    }
+}
+
+// Seven bits a byte, the lowest first, of the value with its sign moved to the lowest bit
+static void putVarint(std::vector<uint8_t> *bytes, int32_t value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    while (zigzag >= 0x80) {
+        bytes->push_back((zigzag & 0x7f) | 0x80);
+        zigzag >>= 7;
+    }
+    bytes->push_back(zigzag);
+}
+
+static int32_t getVarint(const uint8_t **bytes)
+{
+    uint32_t zigzag = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *(*bytes)++;
+        zigzag |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2020 Marios Christoforakis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Offline converter from any image stb_image can decode to a KTX file with a full mip chain,
+// in the layout the game expects (first row at the bottom).
+//
+// usage: ktxconv <bc1|bc5|rgba> <input image> <output.ktx>
+//   bc1  - RGB compressed to 4 bits per pixel, for diffuse maps
+//   bc5  - red and green compressed to 8 bits per pixel, for normal maps
+//   rgba - uncompressed 8 bits per channel
+
+#include "ktx.h"
+
+#define STB_IMAGE_IMPLEMENTATION // nessesary to use stb_image.h
+#include "stb_image.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_RG 0x8227
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_RGBA8 0x8058
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define ABS_DIFF(a, b) ((a) > (b) ? (a) - (b) : (b) - (a))
+
+enum Format {
+    FORMAT_BC1,
+    FORMAT_BC5,
+    FORMAT_RGBA
+};
+
+struct Image
+{
+    int width, height;
+    std::vector<unsigned char> pixels; // RGBA
+};
+
+static Image downsample(const Image &image, bool renormalize);
+static void encodeBC1Block(const unsigned char *block, std::vector<unsigned char> &out);
+static void encodeBC4Block(const unsigned char *block, int channel, std::vector<unsigned char> &out);
+static std::vector<unsigned char> encode(const Image &image, Format format);
+
+int main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <bc1|bc5|rgba> <input image> <output.ktx>\n", argv[0]);
+        return 1;
+    }
+    Format format;
+    if (strcmp(argv[1], "bc1") == 0) {
+        format = FORMAT_BC1;
+    }
+    else if (strcmp(argv[1], "bc5") == 0) {
+        format = FORMAT_BC5;
+    }
+    else if (strcmp(argv[1], "rgba") == 0) {
+        format = FORMAT_RGBA;
+    }
+    else {
+        fprintf(stderr, "unknown format %s\n", argv[1]);
+        return 1;
+    }
+
+    Image image;
+    int channels;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char *data = stbi_load(argv[2], &image.width, &image.height, &channels, 4);
+    if (!data) {
+        fprintf(stderr, "failed to load %s: %s\n", argv[2], stbi_failure_reason());
+        return 1;
+    }
+    image.pixels.assign(data, data + image.width * image.height * 4);
+    stbi_image_free(data);
+
+    const uint32_t width = image.width, height = image.height;
+    std::vector<std::vector<unsigned char> > levels;
+    levels.push_back(encode(image, format));
+    while (image.width > 1 || image.height > 1) {
+        // normal maps are renormalized, so that lower levels do not flatten the surface
+        image = downsample(image, format == FORMAT_BC5);
+        levels.push_back(encode(image, format));
+    }
+
+    static const uint8_t identifier[12] = KTX_IDENTIFIER;
+    KtxHeader header;
+    memcpy(header.identifier, identifier, sizeof(identifier));
+    header.endianness = KTX_ENDIANNESS;
+    header.glType = format == FORMAT_RGBA ? GL_UNSIGNED_BYTE : 0;
+    header.glTypeSize = 1;
+    header.glFormat = format == FORMAT_RGBA ? GL_RGBA : 0;
+    header.glInternalFormat = format == FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : format == FORMAT_BC5 ? GL_COMPRESSED_RG_RGTC2 : GL_RGBA8;
+    header.glBaseInternalFormat = format == FORMAT_BC1 ? GL_RGB : format == FORMAT_BC5 ? GL_RG : GL_RGBA;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.pixelDepth = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = levels.size();
+    header.bytesOfKeyValueData = 0;
+
+    FILE *file = fopen(argv[3], "wb");
+    if (!file) {
+        fprintf(stderr, "failed to open %s\n", argv[3]);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    for (std::vector<std::vector<unsigned char> >::const_iterator it = levels.cbegin(); it != levels.cend(); ++it) {
+        static const unsigned char padding[3] = { 0, 0, 0 };
+        uint32_t imageSize = it->size();
+        fwrite(&imageSize, sizeof(imageSize), 1, file);
+        fwrite(&(*it)[0], 1, imageSize, file);
+        fwrite(padding, 1, 3 - (imageSize + 3) % 4, file);
+    }
+    fclose(file);
+    return 0;
+}
+
+static Image downsample(const Image &image, bool renormalize)
+{
+    Image half;
+    half.width = MAX(image.width / 2, 1);
+    half.height = MAX(image.height / 2, 1);
+    half.pixels.resize(half.width * half.height * 4);
+    for (int y = 0; y < half.height; ++y) {
+        for (int x = 0; x < half.width; ++x) {
+            // average the 2x2 footprint, clamped for odd and single pixel dimensions
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int k = 0; k < 4; ++k) {
+                int sx = MIN(x * 2 + (k & 1), image.width - 1), sy = MIN(y * 2 + (k >> 1), image.height - 1);
+                for (int c = 0; c < 4; ++c) {
+                    sum[c] += image.pixels[(sy * image.width + sx) * 4 + c] / 4.0f;
+                }
+            }
+            if (renormalize) {
+                float n[3], length = 0.0f;
+                for (int c = 0; c < 3; ++c) {
+                    n[c] = sum[c] / 255.0f * 2.0f - 1.0f;
+                    length += n[c] * n[c];
+                }
+                length = sqrtf(length);
+                for (int c = 0; c < 3 && length > 0.0f; ++c) {
+                    sum[c] = (n[c] / length * 0.5f + 0.5f) * 255.0f;
+                }
+            }
+            for (int c = 0; c < 4; ++c) {
+                half.pixels[(y * half.width + x) * 4 + c] = (unsigned char)MIN(MAX(sum[c] + 0.5f, 0.0f), 255.0f);
+            }
+        }
+    }
+    return half;
+}
+
+static std::vector<unsigned char> encode(const Image &image, Format format)
+{
+    if (format == FORMAT_RGBA) {
+        return image.pixels;
+    }
+
+    std::vector<unsigned char> out;
+    for (int by = 0; by < image.height; by += 4) {
+        for (int bx = 0; bx < image.width; bx += 4) {
+            // gather the 4x4 block, repeating the edge pixels of levels smaller than a block
+            unsigned char block[16 * 4];
+            for (int i = 0; i < 16; ++i) {
+                int x = MIN(bx + i % 4, image.width - 1), y = MIN(by + i / 4, image.height - 1);
+                memcpy(block + i * 4, &image.pixels[(y * image.width + x) * 4], 4);
+            }
+            if (format == FORMAT_BC1) {
+                encodeBC1Block(block, out);
+            }
+            else {
+                encodeBC4Block(block, 0, out);
+                encodeBC4Block(block, 1, out);
+            }
+        }
+    }
+    return out;
+}
+
+static uint16_t toRGB565(const int *color)
+{
+    return (uint16_t)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+}
+
+static void fromRGB565(uint16_t packed, int *color)
+{
+    color[0] = (packed >> 11 & 31) * 255 / 31;
+    color[1] = (packed >> 5 & 63) * 255 / 63;
+    color[2] = (packed & 31) * 255 / 31;
+}
+
+static void encodeBC1Block(const unsigned char *block, std::vector<unsigned char> &out)
+{
+    // use the corners of the bounding box of the colors as the endpoints
+    int low[3] = { 255, 255, 255 }, high[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            low[c] = MIN(low[c], block[i * 4 + c]);
+            high[c] = MAX(high[c], block[i * 4 + c]);
+        }
+    }
+    uint16_t color0 = toRGB565(high), color1 = toRGB565(low);
+    uint32_t indices = 0;
+    if (color0 < color1) {
+        uint16_t swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+    if (color0 != color1) {
+        // color0 > color1 selects the four color mode
+        int palette[4][3];
+        fromRGB565(color0, palette[0]);
+        fromRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDistance = 0x7fffffff;
+            for (int p = 0; p < 4; ++p) {
+                int distance = 0;
+                for (int c = 0; c < 3; ++c) {
+                    int d = block[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (i * 2);
+        }
+    }
+    unsigned char encoded[8] = { (unsigned char)(color0 & 0xff), (unsigned char)(color0 >> 8), (unsigned char)(color1 & 0xff), (unsigned char)(color1 >> 8),
+                                 (unsigned char)(indices & 0xff), (unsigned char)(indices >> 8 & 0xff), (unsigned char)(indices >> 16 & 0xff), (unsigned char)(indices >> 24) };
+    out.insert(out.end(), encoded, encoded + 8);
+}
+
+static void encodeBC4Block(const unsigned char *block, int channel, std::vector<unsigned char> &out)
+{
+    int low = 255, high = 0;
+    for (int i = 0; i < 16; ++i) {
+        low = MIN(low, block[i * 4 + channel]);
+        high = MAX(high, block[i * 4 + channel]);
+    }
+    uint64_t indices = 0;
+    if (high != low) {
+        // red0 > red1 selects the mode with six interpolated values between the endpoints
+        int palette[8] = { high, low };
+        for (int p = 1; p < 7; ++p) {
+            palette[p + 1] = ((7 - p) * high + p * low) / 7;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDistance = 256;
+            for (int p = 0; p < 8; ++p) {
+                int distance = ABS_DIFF(block[i * 4 + channel], palette[p]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t)best << (i * 3);
+        }
+    }
+    out.push_back((unsigned char)high);
+    out.push_back((unsigned char)low);
+    for (int i = 0; i < 6; ++i) {
+        out.push_back((unsigned char)(indices >> (i * 8) & 0xff));
+    }
+}